@@ -1,6 +1,21 @@
 #include <linux/btf.h>
 #include <linux/btf_ids.h>
+#include <linux/cred.h>
+#include <linux/debugfs.h>
+#include <linux/errqueue.h>
+#include <linux/error-injection.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/proc_fs.h>
+#include <linux/random.h>
+#include <linux/rculist.h>
+#include <linux/relay.h>
+#include <linux/rhashtable.h>
+#include <linux/seq_file.h>
+#include <net/genetlink.h>
+#include <net/ipv6.h>
 #include <net/tcp.h>
 
 #include "tcp_leo.h"
@@ -11,14 +26,12 @@ EXPORT_SYMBOL(leo_debug);
 #define LEO_SOCKET(leo)	((leo)->sock)
 
 #define SEC_PER_MIN			60
+#define MSEC_PER_MIN			(SEC_PER_MIN * MSEC_PER_SEC)
 #define NSEC_PER_MIN			(SEC_PER_MIN * NSEC_PER_SEC)
-#define LEO_HANDOVER_TIME		(12LLU * NSEC_PER_SEC * HZ)
+#define MSEC_TO_LEO_JIFFIES(ms)		((u64)(ms) * NSEC_PER_MSEC * HZ)
+#define LEO_HANDOVER_TIME_MS		(12U * MSEC_PER_SEC)
 #define LEO_HANDOVER_TIME_JITTER	(10LLU * NSEC_PER_MSEC * HZ)
-#define LEO_HANDOVER_START						\
-	(LEO_HANDOVER_TIME - LEO_HANDOVER_OFFSET_START * NSEC_PER_MSEC * HZ)
-#define LEO_HANDOVER_END						\
-	(LEO_HANDOVER_START + LEO_HANDOVER_DURATION * NSEC_PER_MSEC * HZ)
-#define LEO_HANDOVER_INTERVAL	(15LLU * NSEC_PER_SEC * HZ)
+#define LEO_HANDOVER_INTERVAL_MS	(15U * MSEC_PER_SEC)
 
 #define LEO_SYNC_INTERVAL		(1LLU * NSEC_PER_MIN)
 
@@ -29,25 +42,311 @@ static s64 leo_jiffies_base __read_mostly;
 #define __LEO_HANDOVER_OFFSET(v)					\
 	((u64)(v) <= LEO_HANDOVER_OFFSET_MAX ?				\
 	 (u64)(v) : LEO_HANDOVER_OFFSET_MAX)
-#define LEO_HANDOVER_OFFSET_START					\
-	__LEO_HANDOVER_OFFSET(leo_handover_start_ms)
-#define LEO_HANDOVER_DURATION						\
-	__LEO_HANDOVER_OFFSET(leo_handover_duration_ms)
-static int leo_handover_start_ms __read_mostly =
+static unsigned int leo_handover_start_ms __read_mostly =
     LEO_HANDOVER_OFFSET_DEFAULT;
-static int leo_handover_duration_ms __read_mostly =
+static unsigned int leo_handover_duration_ms __read_mostly =
     LEO_HANDOVER_DURATION_DEFAULT;
 static struct hrtimer leo_jiffies_sync_timer;
 
+/*
+ * the handover schedule is replaced as a whole with RCU so that
+ * ACK processing never takes a lock.  the schedule is given by
+ * module parameters, or pushed by a daemon via generic netlink.
+ * times are in the handover interval and in the unit of leo_jiffies().
+ */
+struct leo_schedule {
+	u64 interval;
+	u64 time;		/* handover */
+	u64 start;		/* window start */
+	u64 end;		/* window end */
+	u64 offset;		/* phase offset, 0<=offset<interval */
+	u32 interval_ms;
+	u32 time_ms;
+	u32 start_ms;		/* window start before handover */
+	u32 duration_ms;
+	s32 offset_ms;
+	struct rcu_head rcu;
+};
+static struct leo_schedule __rcu *leo_schedule;
+static DEFINE_MUTEX(leo_schedule_lock);
+/* an outage notified by a daemon suspends all until its end. */
+static bool leo_outage __read_mostly;
+/* fires at every window edge to notify listeners. */
+static struct hrtimer leo_edge_timer;
+static struct genl_family leo_genl_family;
+/* the schedule shared with user space, see struct leo_shared_page. */
+static struct leo_shared_page *leo_shared;
+static DEFINE_SPINLOCK(leo_shared_lock);
+
+/*
+ * routes decide whether and how sockets run LEO by their peers
+ * with longest prefix match.  the list is sorted by prefix length
+ * in descending order, and the first match is thus the longest.
+ * it is consulted once per connection under rcu_read_lock(), and
+ * the result is cached in struct leo until leo_route_gen changes.
+ * a socket matching no route runs LEO with the global schedule.
+ */
+struct leo_route {
+	struct list_head list;
+	struct rcu_head rcu;
+	struct in6_addr prefix;		/* IPv4 is mapped to IPv6 */
+	u8 plen;
+	u8 mode;			/* enum leo_route_mode */
+	u8 flags;			/* LEO_ROUTE_F_* */
+	u32 start_ms;
+	u32 duration_ms;
+	s32 offset_ms;			/* added to the schedule offset */
+};
+#define LEO_ROUTE_F_START		0x1
+#define LEO_ROUTE_F_DURATION		0x2
+#define LEO_ROUTE_F_OFFSET		0x4
+static const char * const leo_route_mode_names[] = {
+	[LEO_ROUTE_ENABLE]	= "enable",
+	[LEO_ROUTE_DISABLE]	= "disable",
+	[LEO_ROUTE_SHADOW]	= "shadow",
+};
+static LIST_HEAD(leo_routes);
+static DEFINE_MUTEX(leo_route_lock);
+static unsigned int leo_route_gen;	/* bumped on every change */
+
+/*
+ * sockets run LEO only if they egress one of leo_ifindex, e.g.,
+ * the dish uplink, or any interface if none is given.  this is
+ * evaluated at initialization, and re-evaluated on idle restart,
+ * RTO and every timer of running sockets as routes may change.
+ */
+#define LEO_IFINDEX_MAX			8
+static int leo_ifindex[LEO_IFINDEX_MAX];
+static unsigned int leo_nifindex;
+
+/*
+ * every socket running LEO is linked to leo_list for bulk walks,
+ * and to leo_hash for lookups from the socket and for dumps in
+ * /proc/tcp_leo/sockets.  writers of leo_list serialize with
+ * leo_list_lock while readers only hold rcu_read_lock().  leo_hash
+ * grows with the number of sockets so that lookups on every ACK stay
+ * O(1), and keys may be duplicated while a released state waits for
+ * its timer.
+ */
+static HLIST_HEAD(leo_list);
+static struct rhltable leo_hash;
+static const struct rhashtable_params leo_hash_params = {
+	.head_offset		= offsetof(struct leo, node),
+	.key_offset		= offsetof(struct leo, sock),
+	.key_len		= sizeof(void *),
+	.automatic_shrinking	= true,
+};
+static DEFINE_SPINLOCK(leo_list_lock);
+
+/*
+ * what outlives the state freed while idle, from leo_init() until
+ * leo_release().  this is small and
+ * has no timer so that idle sockets still cost little.  linked to
+ * leo_sock_hash with the socket locked.
+ */
+struct leo_sock {
+	struct rhash_head hash;
+	struct rcu_head rcu;
+	struct sock *sk;
+	bool shadow;			/* the role kept across activations */
+	bool notify;			/* subscribed even if not active */
+	bool detached;			/* not activated until re-evaluated */
+};
+static struct rhashtable leo_sock_hash;
+static const struct rhashtable_params leo_sock_hash_params = {
+	.head_offset		= offsetof(struct leo_sock, hash),
+	.key_offset		= offsetof(struct leo_sock, sk),
+	.key_len		= sizeof(struct sock *),
+	.automatic_shrinking	= true,
+};
+static struct proc_dir_entry *leo_proc_dir;
+
+/*
+ * per-ACK samples are written to per-CPU relay buffers, i.e.,
+ * /sys/kernel/debug/tcp_leo/trace<cpu>, that can be mmap(2)ed.
+ * tracing is disabled unless leo_trace_subbuf_size is given.
+ */
+static unsigned int leo_trace_subbuf_size __read_mostly;
+static unsigned int leo_trace_nsubbufs __read_mostly = 8;
+static unsigned int leo_trace_sample __read_mostly = 1;
+static struct dentry *leo_debugfs_dir;
+static struct rchan *leo_trace_chan __read_mostly;
+static DEFINE_PER_CPU(unsigned int, leo_trace_count);
+
+/*
+ * per-CPU histograms of RTT, losses and delivered bytes binned
+ * by the phase in the handover interval, which are exported to
+ * /proc/tcp_leo/histogram.  disabled unless leo_hist_bin_ms is given.
+ */
+struct leo_hist_bin {
+	u64 rtt_sum_us;
+	u32 rtt_cnt;
+	u32 rtt_min_us;
+	u32 rtt_max_us;
+	u32 lost;
+	u64 delivered_bytes;
+};
+static unsigned int leo_hist_bin_ms __read_mostly;
+static unsigned int leo_hist_nbins __read_mostly;
+static struct leo_hist_bin __percpu *leo_hist __read_mostly;
+
+/*
+ * a socket runs in the shadow mode with the probability of
+ * leo_shadow_percent.  a shadow socket computes every suspension
+ * and resumption, but never touches cwnd.  statistics are kept
+ * separately for active and shadow sockets, and are exported to
+ * /proc/tcp_leo/stats for A/B comparison.
+ */
+static unsigned int leo_shadow_percent __read_mostly;
+enum leo_stat {
+	LEO_STAT_SOCKETS,	/* sockets initialized */
+	LEO_STAT_WINDOWS,	/* handover windows */
+	LEO_STAT_INFLIGHT,	/* packets in flight at window start */
+	LEO_STAT_LOST,		/* packets lost in windows */
+	LEO_STAT_RETRANS,	/* packets retransmitted in windows */
+	LEO_STAT_RTO,		/* RTOs in windows */
+	LEO_STAT_BYTES,		/* bytes acked by finished sockets */
+	LEO_STAT_RETRANS_TOTAL,	/* packets retransmitted by finished sockets */
+	LEO_STAT_DURATION_MS,	/* lifetime of finished sockets */
+	LEO_STAT_GUARD,		/* RTT samples in guard bands */
+	LEO_STAT_UNDO,		/* reductions undone after windows */
+	LEO_STAT_MAX
+};
+static const char * const leo_stat_names[LEO_STAT_MAX] = {
+	[LEO_STAT_SOCKETS]		= "sockets",
+	[LEO_STAT_WINDOWS]		= "windows",
+	[LEO_STAT_INFLIGHT]		= "window_inflight",
+	[LEO_STAT_LOST]			= "window_lost",
+	[LEO_STAT_RETRANS]		= "window_retrans",
+	[LEO_STAT_RTO]			= "window_rto",
+	[LEO_STAT_BYTES]		= "bytes_acked",
+	[LEO_STAT_RETRANS_TOTAL]	= "retrans",
+	[LEO_STAT_DURATION_MS]		= "duration_ms",
+	[LEO_STAT_GUARD]		= "guard_samples",
+	[LEO_STAT_UNDO]			= "undo",
+};
+static atomic64_t leo_stats[2][LEO_STAT_MAX];	/* active, shadow */
+#define LEO_STAT_ADD(leo, stat, v)					\
+	atomic64_add((v), &leo_stats[(leo)->shadow][(stat)])
+
+/* LEO_STAT_GUARD counts ACKs, and is per-CPU not to share a line. */
+struct leo_guard_stat {
+	u64 samples[2];			/* active, shadow */
+};
+static DEFINE_PER_CPU(struct leo_guard_stat, leo_guard_stats);
+
+/*
+ * latency from the scheduled end of a window to the first
+ * transmission after resumption of an active socket, by what woke
+ * the socket up.  bucket i holds latencies less than 2^i ms, and
+ * the last one holds the rest.  exported to /proc/tcp_leo/resume.
+ */
+enum leo_resume_cause {
+	LEO_RESUME_NONE,	/* not measured */
+	LEO_RESUME_TIMER,	/* pushed by the timer */
+	LEO_RESUME_ACK,		/* clocked out by an ACK */
+	LEO_RESUME_APP,		/* written by an idle application */
+	LEO_RESUME_RTO,		/* retransmitted by RTO */
+	LEO_RESUME_MAX
+};
+static const char * const leo_resume_names[LEO_RESUME_MAX] = {
+	[LEO_RESUME_NONE]	= "none",
+	[LEO_RESUME_TIMER]	= "timer",
+	[LEO_RESUME_ACK]	= "ack",
+	[LEO_RESUME_APP]	= "app",
+	[LEO_RESUME_RTO]	= "rto",
+};
+#define LEO_RESUME_NBUCKETS	14
+static atomic64_t leo_resume_hist[LEO_RESUME_MAX][LEO_RESUME_NBUCKETS];
+static atomic64_t leo_resume_sum_us[LEO_RESUME_MAX];
+
+/*
+ * a reduction of cwnd in a window or its guard band is likely by
+ * handover rather than congestion.  cwnd and ssthresh before it are
+ * restored once the path is found healthy after resumption, i.e.,
+ * cwnd worth of packets are delivered without loss in TCP_CA_Open.
+ */
+enum leo_undo_state {
+	LEO_UNDO_NONE,
+	LEO_UNDO_ARMED,		/* reduced around a window */
+	LEO_UNDO_CHECK,		/* checking the path after the window */
+};
+
+/*
+ * a socket subscribed via generic netlink is notified of a coming
+ * window leo_notify_lead_ms before it, and of the resumption, on
+ * its error queue.  see enum leo_notify.
+ */
+static unsigned int leo_notify_lead_ms __read_mostly = 100;
+
+/*
+ * the state of a socket is allocated when it starts sending, and
+ * freed after it has been idle for leo_idle_ms.
+ */
+static unsigned int leo_idle_ms __read_mostly = 30 * MSEC_PER_SEC;
+
+/*
+ * RTT samples sent or acked within leo_handover_guard_ms around a
+ * window are inflated by the reconfiguration, and are dropped from
+ * delay based heuristics, e.g., HyStart.
+ */
+static unsigned int leo_handover_guard_ms __read_mostly = 100;
+
+/*
+ * applications keep writing while suspended.  the send buffer is
+ * expanded by a window worth of data at the delivery rate before it
+ * not to block writers, and shrunk back after it.
+ */
+static bool leo_sndbuf_expand __read_mostly = true;
+
+/*
+ * suspend a socket when an idle application starts writing in a
+ * window.  this can be turned off to compare retransmissions, see
+ * tools/leo-retrans.sh.
+ */
+static bool leo_tx_start __read_mostly = true;
+
 /* XXX */
+static struct leo *leo_lookup(const struct sock *);
+static struct leo *leo_activate(struct sock *, u32 *);
 static void leo_finish(struct leo *);
+static void leo_shared_update(void);
 
 module_param(leo_debug, bool, 0644);
 MODULE_PARM_DESC(leo_debug, "debug flag");
-module_param(leo_handover_start_ms, uint, 0644);
+static int leo_param_set_ms(const char *, const struct kernel_param *);
+static const struct kernel_param_ops leo_param_ms_ops = {
+	.set	= leo_param_set_ms,
+	.get	= param_get_uint,
+};
+module_param_cb(leo_handover_start_ms, &leo_param_ms_ops,
+    &leo_handover_start_ms, 0644);
 MODULE_PARM_DESC(leo_handover_start_ms, "starting offset of handover (0<=offset<=1000)");
-module_param(leo_handover_duration_ms, uint, 0644);
+module_param_cb(leo_handover_duration_ms, &leo_param_ms_ops,
+    &leo_handover_duration_ms, 0644);
 MODULE_PARM_DESC(leo_handover_duration_ms, "duration of handover (0<=duration<=1000)");
+module_param(leo_trace_subbuf_size, uint, 0444);
+MODULE_PARM_DESC(leo_trace_subbuf_size, "size of per-CPU trace sub-buffer in bytes (0: disable tracing)");
+module_param(leo_trace_nsubbufs, uint, 0444);
+MODULE_PARM_DESC(leo_trace_nsubbufs, "number of per-CPU trace sub-buffers");
+module_param(leo_trace_sample, uint, 0644);
+MODULE_PARM_DESC(leo_trace_sample, "trace one in every N ACKs (0: stop tracing)");
+module_param(leo_shadow_percent, uint, 0644);
+MODULE_PARM_DESC(leo_shadow_percent, "percentage of sockets in shadow mode (0<=percent<=100)");
+module_param(leo_hist_bin_ms, uint, 0444);
+MODULE_PARM_DESC(leo_hist_bin_ms, "width of phase histogram bins in ms (0: disable histograms)");
+module_param_array(leo_ifindex, int, &leo_nifindex, 0644);
+MODULE_PARM_DESC(leo_ifindex, "ifindexes of LEO uplinks (empty: all interfaces)");
+module_param(leo_idle_ms, uint, 0644);
+MODULE_PARM_DESC(leo_idle_ms, "free the state of sockets idle for this ms (0: never)");
+module_param(leo_notify_lead_ms, uint, 0644);
+MODULE_PARM_DESC(leo_notify_lead_ms, "notify subscribed sockets of a window this ms in advance (0: at start)");
+module_param(leo_sndbuf_expand, bool, 0644);
+MODULE_PARM_DESC(leo_sndbuf_expand, "expand send buffers by a window worth of data while suspended");
+module_param(leo_tx_start, bool, 0644);
+MODULE_PARM_DESC(leo_tx_start, "suspend sends starting in a window");
+module_param(leo_handover_guard_ms, uint, 0644);
+MODULE_PARM_DESC(leo_handover_guard_ms, "drop RTT samples this ms around windows (0: never)");
 
 static s64
 leo_jiffies_base_compute(void)
@@ -97,6 +396,7 @@ leo_jiffies_sync(struct hrtimer *hrt)
 
 	/* do not strictly care the race condition. */
 	leo_jiffies_base = njiffies;
+	leo_shared_update();
 
 	return HRTIMER_NORESTART;
 }
@@ -137,27 +437,157 @@ leo_time(void)
 }
 #endif /* ! LEO_NODEBUG */
 
+/* must be called under rcu_read_lock(). */
+static const struct leo_schedule *
+leo_schedule_get(void)
+{
+
+	return rcu_dereference(leo_schedule);
+}
+
+/* time in the handover interval. */
+static u64
+leo_phase(const struct leo_schedule *ls)
+{
+
+	return (leo_jiffies() + ls->offset) % ls->interval;
+}
+
+/*
+ * the schedule of a socket, i.e., the global one adjusted by the
+ * route of its peer.  buf is used only if adjusted.  must be called
+ * under rcu_read_lock().
+ */
+static const struct leo_schedule *
+leo_sock_schedule(const struct leo *leo, struct leo_schedule *buf)
+{
+	const struct leo_schedule *ls = leo_schedule_get();
+	s64 offset_ms;
+
+	if (leo == NULL || leo->route_flags == 0)
+		return ls;
+
+	*buf = *ls;
+	if (leo->route_flags & LEO_ROUTE_F_START)
+		buf->start_ms = min(leo->route_start_ms, buf->time_ms);
+	if (leo->route_flags & LEO_ROUTE_F_DURATION)
+		buf->duration_ms = leo->route_duration_ms;
+	if (leo->route_flags & LEO_ROUTE_F_OFFSET)
+		buf->offset_ms += leo->route_offset_ms;
+	/* the window must end in the interval. */
+	if (buf->time_ms - buf->start_ms + buf->duration_ms >= buf->interval_ms)
+		buf->duration_ms = buf->interval_ms - 1 -
+		    (buf->time_ms - buf->start_ms);
+	offset_ms = buf->offset_ms % (s64)buf->interval_ms;
+	if (offset_ms < 0)
+		offset_ms += buf->interval_ms;
+	buf->start = buf->time - MSEC_TO_LEO_JIFFIES(buf->start_ms);
+	buf->end = buf->start + MSEC_TO_LEO_JIFFIES(buf->duration_ms);
+	buf->offset = MSEC_TO_LEO_JIFFIES(offset_ms);
+	return buf;
+}
+
 /*
  * leo does scan or handover at the fixed timing,
  * 12s, 27s, 42s, 57s for each minute.
  * XXX: only at 27s, handover occurs???
  */
 static bool
-is_leo_handover(void)
+is_leo_handover(const struct leo *leo)
 {
+	const struct leo_schedule *ls;
+	struct leo_schedule lsbuf;
 	u64 njiffies;
+	bool ret;
+
+	if (READ_ONCE(leo_outage))
+		return true;
+
+	rcu_read_lock();
+	ls = leo_sock_schedule(leo, &lsbuf);
+	njiffies = leo_phase(ls);
+	ret = ls->start <= njiffies && njiffies <= ls->end;
+	rcu_read_unlock();
+
+	return ret;
+}
+
+/* a phase is in a window widened by guard on both sides. */
+static bool
+leo_in_guard(const struct leo_schedule *ls, u64 njiffies, u64 guard)
+{
+	u64 lo;
 
-	njiffies = leo_jiffies() % LEO_HANDOVER_INTERVAL;
-	return LEO_HANDOVER_START <= njiffies &&
-	    njiffies <= LEO_HANDOVER_END;
+	lo = (ls->start + ls->interval - guard % ls->interval) % ls->interval;
+	return (njiffies + ls->interval - lo) % ls->interval <=
+	    ls->end - ls->start + 2 * guard;
 }
 
 static unsigned long
 leo_handover_duration(struct sock *sk)
 {
+	const struct leo_schedule *ls;
+	struct leo_schedule lsbuf;
+	unsigned long duration;
+
+	rcu_read_lock();
+	ls = leo_sock_schedule(leo_lookup(sk), &lsbuf);
+	duration = ls->start_ms + ls->duration_ms;
+	rcu_read_unlock();
+
+	return duration;
+}
+
+/* must be called under rcu_read_lock(). */
+static struct leo *
+leo_lookup(const struct sock *sk)
+{
+	struct rhlist_head *list, *pos;
+	struct leo *leo;
+
+	list = rhltable_lookup(&leo_hash, &sk, leo_hash_params);
+	rhl_for_each_entry_rcu(leo, pos, list, node)
+		if (! leo->released)
+			return leo;
+	return NULL;
+}
+
+/* must be called under rcu_read_lock(). */
+static struct leo_sock *
+leo_sock_lookup(const struct sock *sk)
+{
+
+	return rhashtable_lookup(&leo_sock_hash, &sk, leo_sock_hash_params);
+}
+
+/*
+ * no longer activate the socket until leo_reevaluate(), e.g., as its
+ * egress changed.  called with the socket locked.
+ */
+static void
+leo_sock_detach(struct sock *sk)
+{
+	struct leo_sock *lsk;
+
+	rcu_read_lock();
+	lsk = leo_sock_lookup(sk);
+	if (lsk != NULL)
+		lsk->detached = true;
+	rcu_read_unlock();
+}
 
-	(void)sk; /* XXX: different duration per socket in future. */
-	return leo_handover_start_ms + leo_handover_duration_ms;
+/* called with the socket locked. */
+static void
+leo_sock_del(struct sock *sk)
+{
+	struct leo_sock *lsk;
+
+	rcu_read_lock();
+	lsk = leo_sock_lookup(sk);
+	if (lsk != NULL && rhashtable_remove_fast(&leo_sock_hash,
+	    &lsk->hash, leo_sock_hash_params) == 0)
+		kfree_rcu(lsk, rcu);
+	rcu_read_unlock();
 }
 
 __bpf_kfunc static void
@@ -198,8 +628,9 @@ leo_resume_transmission(struct sock *sk, u32 last_snd_cwnd)
 	tcp_check_space(sk);
 #else /* TCP_LEO */
 	/*
-	 * XXX: should call tcp_push_pending_frames(),
-	 * but symbol is missing...
+	 * tcp_push_pending_frames() is missing, and the timer pushes
+	 * pending frames by leo_push() instead.  an ACK pushes them
+	 * by itself.
 	 */
 	if (sk->sk_socket &&
 	    test_bit(SOCK_NOSPACE, &sk->sk_socket->flags)) {
@@ -214,39 +645,190 @@ leo_resume_transmission(struct sock *sk, u32 last_snd_cwnd)
 #endif /* ! TCP_LEO */
 }
 
+/*
+ * push pending frames on resumption by the timer.  stock kernels
+ * export neither tcp_push_pending_frames() nor tcp_check_space(),
+ * and TSQ deferral is borrowed instead: TCP_TSQ_DEFERRED makes
+ * tcp_release_cb() write pending frames, which is called here or
+ * by release_sock() if the socket is owned by user.  this must not
+ * be called in the middle of ACK processing nor transmission, and
+ * the socket spinlock must be held.
+ */
+static void
+leo_push(struct sock *sk)
+{
+
+#ifndef TCP_LEO
+	/* the reference is put by tcp_release_cb(). */
+	if (! test_and_set_bit(TCP_TSQ_DEFERRED, &sk->sk_tsq_flags))
+		sock_hold(sk);
+	if (! sock_owned_by_user(sk))
+		tcp_release_cb(sk);
+#endif /* ! TCP_LEO */
+}
+
+/*
+ * a shadow socket never suspends transmission, and only
+ * remembers whether it would have been suspended.
+ */
+static bool
+is_leo_suspended(struct sock *sk, const struct leo *leo)
+{
+
+	if (leo != NULL && leo->shadow)
+		return leo->suspended;
+	return tcp_snd_cwnd(tcp_sk(sk)) == 0;
+}
+
+/*
+ * a hook for BPF programs to override handover decisions, i.e.,
+ *	SEC("fmod_ret/leo_policy")
+ *	int BPF_PROG(policy, struct leo_policy_ctx *ctx, int ret)
+ * which returns enum leo_policy_verdict.  the default is to follow
+ * the schedule.  this is not a struct_ops as it cannot be defined by
+ * a module on kernels we support.
+ */
+static noinline int
+leo_policy(struct leo_policy_ctx *ctx)
+{
+
+	/* prevent the call from being optimized out. */
+	asm volatile ("");
+	return LEO_POLICY_DEFAULT;
+}
+ALLOW_ERROR_INJECTION(leo_policy, TRUE);
+
+static bool
+leo_policy_decide(struct sock *sk, struct leo *leo,
+    enum leo_policy_point point, bool handover)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	const struct leo_schedule *ls;
+	struct leo_schedule lsbuf;
+	struct leo_policy_ctx ctx;
+
+	ctx.sk = sk;
+	ctx.point = point;
+	rcu_read_lock();
+	ls = leo_sock_schedule(leo, &lsbuf);
+	ctx.phase_us = leo_phase(ls) / HZ / NSEC_PER_USEC;
+	ctx.interval_us = ls->interval / HZ / NSEC_PER_USEC;
+	ctx.start_us = ls->start / HZ / NSEC_PER_USEC;
+	ctx.end_us = ls->end / HZ / NSEC_PER_USEC;
+	rcu_read_unlock();
+	ctx.rtt_us = tp->rack.rtt_us;
+	ctx.srtt_us = tp->srtt_us >> 3;
+	ctx.min_rtt_us = tcp_min_rtt(tp);
+	ctx.nsuspend = leo != NULL ? leo->nsuspend : 0;
+	ctx.handover = handover;
+	ctx.suspended = is_leo_suspended(sk, leo);
+	ctx.outage = READ_ONCE(leo_outage);
+
+	switch (leo_policy(&ctx)) {
+	case LEO_POLICY_SUSPEND:
+		return true;
+	case LEO_POLICY_RESUME:
+		return false;
+	case LEO_POLICY_KEEP:
+		return ctx.suspended;
+	default:
+		return handover;
+	}
+}
+
+static u64
+leo_notify_lead(const struct leo_schedule *ls)
+{
+
+	/* keep the notice in the current interval. */
+	return min_t(u64, MSEC_TO_LEO_JIFFIES(READ_ONCE(leo_notify_lead_ms)),
+	    ls->interval - (ls->end - ls->start));
+}
+
+/*
+ * queue a notification to the error queue of a subscribed socket.
+ * sk_err is left as is since ee_errno is 0, and the socket is just
+ * woken up with POLLERR.
+ */
+static void
+leo_notify(struct sock *sk, struct leo *leo, u8 type, u32 lead_ms)
+{
+	const struct leo_schedule *ls;
+	struct leo_schedule lsbuf;
+	struct sock_exterr_skb *serr;
+	struct sk_buff *skb;
+
+	if (type == LEO_NOTIFY_SUSPEND)
+		leo->notified = true;
+	else
+		leo->notified = false;
+	if (! leo->notify)
+		return;
+
+	skb = alloc_skb(0, GFP_ATOMIC);
+	if (skb == NULL) {
+		DP("LEO[%p]: notify: allocation failure\n", sk);
+		return;
+	}
+	serr = SKB_EXT_ERR(skb);
+	memset(serr, 0, sizeof(*serr));
+	serr->ee.ee_errno = 0;
+	serr->ee.ee_origin = SO_EE_ORIGIN_LOCAL;
+	serr->ee.ee_type = type;
+	serr->ee.ee_code = LEO_NOTIFY_CODE;
+	serr->ee.ee_info = lead_ms;
+	if (type == LEO_NOTIFY_SUSPEND && ! READ_ONCE(leo_outage)) {
+		rcu_read_lock();
+		ls = leo_sock_schedule(leo, &lsbuf);
+		serr->ee.ee_data = ls->duration_ms;
+		rcu_read_unlock();
+	}
+	if (sock_queue_err_skb(sk, skb) != 0) {
+		DP("LEO[%p]: notify: error queue full\n", sk);
+		kfree_skb(skb);
+	}
+}
+
 static void
 leo_handover_timer_reset(struct leo *leo)
 {
 	struct sock *sk = LEO_SOCKET(leo);
-#ifdef LEO_HANDOVER_TIMER_ONLY
-	struct tcp_sock *tp = tcp_sk(sk);
-#endif /* LEO_HANDOVER_TIMER_ONLY */
+	const struct leo_schedule *ls;
+	struct leo_schedule lsbuf;
 	u64 njiffies;
 	s64 timo;
 
-	njiffies = leo_jiffies() % LEO_HANDOVER_INTERVAL;
+	rcu_read_lock();
+	ls = leo_sock_schedule(leo, &lsbuf);
+	njiffies = leo_phase(ls);
+	if (READ_ONCE(leo_outage))
+		/* the end of the outage kicks the timer. */
+		timo = ls->interval;
 #ifdef LEO_HANDOVER_TIMER_ONLY
-	if (tp->snd_cwnd == 0)
-		timo = LEO_HANDOVER_END - njiffies;
-	else if (njiffies <= LEO_HANDOVER_TIME)
-		timo = LEO_HANDOVER_START - njiffies;
+	else if (is_leo_suspended(sk, leo))
+		timo = ls->end - njiffies;
+	else if (njiffies <= ls->time)
+		timo = ls->start - njiffies;
 	else
-		timo = LEO_HANDOVER_START + LEO_HANDOVER_INTERVAL
-		    - njiffies;
+		timo = ls->start + ls->interval - njiffies;
 #else /* LEO_HANDOVER_TIMER_ONLY */
-	if (njiffies < LEO_HANDOVER_START)
-		timo = LEO_HANDOVER_START - njiffies;
-	else if (njiffies < LEO_HANDOVER_END)
-		timo = LEO_HANDOVER_END - njiffies;
+	else if (njiffies < ls->start)
+		timo = ls->start - njiffies;
+	else if (njiffies < ls->end)
+		timo = ls->end - njiffies;
 	else
-		timo = LEO_HANDOVER_START + LEO_HANDOVER_INTERVAL
-		    - njiffies;
+		timo = ls->start + ls->interval - njiffies;
+	/* wake up earlier to notify the coming window. */
+	if (leo->notify && ! leo->notified && ! is_leo_suspended(sk, leo) &&
+	    ! READ_ONCE(leo_outage) && timo > (s64)leo_notify_lead(ls))
+		timo -= leo_notify_lead(ls);
 #endif /* ! LEO_HANDOVER_TIMER_ONLY */
 	DP("LEO[%p]: handover: timer reset: timo (ms): %lld, start: %llu, time: %llu, "
 	    "end: %llu, int.: %llu, nsec (ms): %llu\n",
-	    sk, timo / NSEC_PER_MSEC / HZ, LEO_HANDOVER_START / HZ,
-	    LEO_HANDOVER_TIME / HZ, LEO_HANDOVER_END / HZ,
-	    LEO_HANDOVER_INTERVAL / HZ, njiffies / HZ);
+	    sk, timo / NSEC_PER_MSEC / HZ, ls->start / HZ,
+	    ls->time / HZ, ls->end / HZ,
+	    ls->interval / HZ, njiffies / HZ);
+	rcu_read_unlock();
 	timo /= NSEC_PER_SEC;
 	if (timo <= 0)
 		timo = 1;
@@ -254,11 +836,102 @@ leo_handover_timer_reset(struct leo *leo)
 }
 
 static void
-leo_handover_start(struct sock *sk)
+leo_window_open(struct sock *sk, struct leo *leo)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+
+	leo->suspended = true;
+	leo->win_inflight = tcp_packets_in_flight(tp);
+	leo->win_lost = tp->lost;
+	leo->win_retrans = tp->total_retrans;
+	leo->win_rto = 0;
+	leo->win_start = jiffies;
+	leo->win_pacing_rate = READ_ONCE(sk->sk_pacing_rate);
+	WRITE_ONCE(leo->nsuspend, leo->nsuspend + 1);
+}
+
+static void
+leo_window_close(struct sock *sk, struct leo *leo)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+
+	leo->suspended = false;
+	LEO_STAT_ADD(leo, LEO_STAT_WINDOWS, 1);
+	LEO_STAT_ADD(leo, LEO_STAT_INFLIGHT, leo->win_inflight);
+	LEO_STAT_ADD(leo, LEO_STAT_LOST, tp->lost - leo->win_lost);
+	LEO_STAT_ADD(leo, LEO_STAT_RETRANS,
+	    tp->total_retrans - leo->win_retrans);
+	LEO_STAT_ADD(leo, LEO_STAT_RTO, leo->win_rto);
+	if (! leo->shadow)
+		WRITE_ONCE(leo->suspended_jiffies,
+		    leo->suspended_jiffies + (jiffies - leo->win_start));
+	WRITE_ONCE(leo->nresume, leo->nresume + 1);
+}
+
+/* must be called before suspension, i.e., with valid cwnd. */
+static void
+leo_sndbuf_window_expand(struct sock *sk, struct leo *leo)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	const struct leo_schedule *ls;
+	struct leo_schedule lsbuf;
+	u64 bytes, duration_us;
+	int sndbuf, wmem_max;
+
+	leo->win_sndbuf = 0;
+	if (! READ_ONCE(leo_sndbuf_expand) ||
+	    (sk->sk_userlocks & SOCK_SNDBUF_LOCK))
+		return;
+
+	rcu_read_lock();
+	ls = leo_sock_schedule(leo, &lsbuf);
+	duration_us = (u64)ls->duration_ms * USEC_PER_MSEC;
+	rcu_read_unlock();
+
+	/* the last rate sample, or cwnd per srtt if none. */
+	if (tp->rate_interval_us != 0)
+		bytes = div_u64((u64)tp->rate_delivered * tp->mss_cache *
+		    duration_us, tp->rate_interval_us);
+	else if (tp->srtt_us != 0)
+		bytes = div_u64((u64)tcp_snd_cwnd(tp) * tp->mss_cache *
+		    duration_us, tp->srtt_us >> 3 ?: 1);
+	else
+		return;
+
+	sndbuf = READ_ONCE(sk->sk_sndbuf);
+	wmem_max = READ_ONCE(sock_net(sk)->ipv4.sysctl_tcp_wmem[2]);
+	if (sndbuf >= wmem_max)
+		return;
+	leo->win_sndbuf = sndbuf;
+	leo->win_sndbuf_expanded = min_t(u64, sndbuf + bytes, wmem_max);
+	WRITE_ONCE(sk->sk_sndbuf, leo->win_sndbuf_expanded);
+	DP("LEO[%p]: sndbuf: expand: %d -> %d\n",
+	    sk, sndbuf, leo->win_sndbuf_expanded);
+	/* writers blocked on SOCK_NOSPACE now have room. */
+	sk->sk_write_space(sk);
+}
+
+static void
+leo_sndbuf_window_shrink(struct sock *sk, struct leo *leo)
+{
+
+	if (leo->win_sndbuf == 0)
+		return;
+	/* unless changed by TCP or the user in the window. */
+	if (READ_ONCE(sk->sk_sndbuf) == leo->win_sndbuf_expanded) {
+		DP("LEO[%p]: sndbuf: shrink: %d -> %d\n",
+		    sk, leo->win_sndbuf_expanded, leo->win_sndbuf);
+		WRITE_ONCE(sk->sk_sndbuf, leo->win_sndbuf);
+	}
+	leo->win_sndbuf = 0;
+}
+
+static void
+leo_handover_start(struct sock *sk, struct leo *leo)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 
-	if (tcp_snd_cwnd(tp) == 0) {
+	if (is_leo_suspended(sk, leo)) {
 		DP("LEO[%p]: handover: start: already started???\n", sk);
 		return;
 	}
@@ -266,126 +939,2136 @@ leo_handover_start(struct sock *sk)
 	DP("LEO[%p]: handover: start: cwnd: %d, inflight: %d\n",
 	    sk, tcp_snd_cwnd(tp), tcp_packets_in_flight(tp));
 
+	if (leo != NULL) {
+		/* nothing was sent since the last window. */
+		leo->resume_ns = 0;
+		leo_window_open(sk, leo);
+		/* unless notified in advance. */
+		if (! leo->notified)
+			leo_notify(sk, leo, LEO_NOTIFY_SUSPEND, 0);
+		if (leo->shadow)
+			return;
+		leo_sndbuf_window_expand(sk, leo);
+	}
 	leo_suspend_transmission(sk);
 }
 
+/*
+ * remember the scheduled end of the window resumed now, and what
+ * is expected to transmit next.  segs is tp->data_segs_out before
+ * resumption.
+ */
+static void
+leo_resume_mark(struct sock *sk, struct leo *leo, u32 segs,
+    enum leo_resume_cause cause)
+{
+	const struct leo_schedule *ls;
+	struct leo_schedule lsbuf;
+	u64 njiffies, late = 0;
+
+	rcu_read_lock();
+	ls = leo_sock_schedule(leo, &lsbuf);
+	njiffies = leo_phase(ls);
+	/* an outage, or an early timer, has no later end. */
+	if (! READ_ONCE(leo_outage) && njiffies >= ls->end)
+		late = div_u64(njiffies - ls->end, HZ);
+	rcu_read_unlock();
+	leo->resume_ns = tcp_clock_ns() - late;
+	leo->resume_segs = segs;
+	leo->resume_cause = cause;
+}
+
+static void
+leo_resume_record(struct sock *sk, struct leo *leo,
+    enum leo_resume_cause cause)
+{
+	unsigned int i = 0;
+	u64 us;
+
+	us = div_u64(tcp_clock_ns() - leo->resume_ns, NSEC_PER_USEC);
+	leo->resume_ns = 0;
+	if (us >= USEC_PER_MSEC)
+		i = min_t(unsigned int, ilog2(div_u64(us, USEC_PER_MSEC)) + 1,
+		    LEO_RESUME_NBUCKETS - 1);
+	atomic64_inc(&leo_resume_hist[cause][i]);
+	atomic64_add(us, &leo_resume_sum_us[cause]);
+	WRITE_ONCE(leo->resume_cnt, leo->resume_cnt + 1);
+	WRITE_ONCE(leo->resume_sum_us, leo->resume_sum_us + us);
+	if (leo->resume_max_us < us)
+		WRITE_ONCE(leo->resume_max_us, min_t(u64, us, U32_MAX));
+	DP("LEO[%p]: handover: resume: %s: %llu us\n", sk,
+	    leo_resume_names[cause], us);
+}
+
+/* the first transmission since resumption, if any. */
+static void
+leo_resume_check(struct sock *sk, struct leo *leo)
+{
+
+	if (leo->resume_ns != 0 &&
+	    tcp_sk(sk)->data_segs_out != leo->resume_segs)
+		leo_resume_record(sk, leo, leo->resume_cause);
+}
+
 static void
-leo_handover_end(struct sock *sk, u32 last_snd_cwnd)
+leo_handover_end(struct sock *sk, struct leo *leo, u32 last_snd_cwnd,
+    enum leo_resume_cause cause)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
+	u32 segs;
+
+	/* cwnd may have been already recovered by RTO. */
+	if (leo != NULL && leo->suspended) {
+		leo_window_close(sk, leo);
+		leo_notify(sk, leo, LEO_NOTIFY_RESUME, 0);
+	}
+	if (leo != NULL && leo->shadow)
+		return;
+	if (leo != NULL)
+		leo_sndbuf_window_shrink(sk, leo);
 
 	if (tcp_snd_cwnd(tp) != 0) {
 		DP("LEO[%p]: handover: end: already cwnd recovered???\n", sk);
 		return;
 	}
 
+	/*
+	 * the pacing rate is updated by ACKs in the window with zero
+	 * cwnd.  restore it not to pace the first flight slowly.
+	 */
+	if (leo != NULL && leo->win_pacing_rate != 0 &&
+	    READ_ONCE(sk->sk_pacing_status) != SK_PACING_NONE)
+		WRITE_ONCE(sk->sk_pacing_rate, leo->win_pacing_rate);
+
+	segs = tp->data_segs_out;
+	/* nothing queued waits for the application. */
+	if (cause != LEO_RESUME_NONE && tcp_send_head(sk) == NULL)
+		cause = LEO_RESUME_APP;
 	leo_resume_transmission(sk, last_snd_cwnd);
+	if (leo != NULL && cause != LEO_RESUME_NONE) {
+		leo_resume_mark(sk, leo, segs, cause);
+		/* pushed by a patched kernel, or right after the ACK. */
+		if (tp->data_segs_out != segs || cause == LEO_RESUME_ACK)
+			leo_resume_record(sk, leo, cause);
+	}
 
 	DP("LEO[%p]: handover: end: recover: cwnd: %d, inflight: %d\n",
 	    sk, tcp_snd_cwnd(tp), tcp_packets_in_flight(tp));
 }
 
 bool
-leo_handover_check(struct sock *sk, u32 last_snd_cwnd)
+leo_handover_check(struct sock *sk, u32 *last_snd_cwnd)
 {
-	struct tcp_sock *tp = tcp_sk(sk);
+	struct leo *leo;
+	bool suspended;
 
+	rcu_read_lock();
+	leo = leo_lookup(sk);
+	if (leo == NULL && tcp_is_cwnd_limited(sk))
+		leo = leo_activate(sk, last_snd_cwnd);
+	if (leo == NULL) {
+		/* not yet active, or runs as the plain algorithm. */
+		rcu_read_unlock();
+		return false;
+	}
 #ifdef LEO_HANDOVER_TIMER_ONLY
-	if (tcp_snd_cwnd(tp) == 0)
-		return true;
+	suspended = is_leo_suspended(sk, leo);
 #else /* LEO_HANDOVER_TIMER_ONLY */
-	if (is_leo_handover()) {
-		if (tcp_snd_cwnd(tp) != 0) {
+	suspended = leo_policy_decide(sk, leo, LEO_POLICY_ACK,
+	    is_leo_handover(leo));
+	if (suspended) {
+		if (! is_leo_suspended(sk, leo)) {
 			DP("LEO[%p]: handover: missing transmission suspension???\n", sk);
-			leo_handover_start(sk);
+			leo_handover_start(sk, leo);
 		}
-		return true;
-	}
-	if (tcp_snd_cwnd(tp) == 0) {
+	} else if (is_leo_suspended(sk, leo)) {
 		DP("LEO[%p]: handover: unrecovered??? forcely recover cwnd.\n", sk);
-		leo_handover_end(sk, last_snd_cwnd);
+		leo_handover_end(sk, leo, *last_snd_cwnd, LEO_RESUME_ACK);
 	}
 #endif /* ! LEO_HANDOVER_TIMER_ONLY */
-	return false;
+	/* congestion control keeps running on a shadow socket. */
+	if (leo->shadow)
+		suspended = false;
+	rcu_read_unlock();
+
+	return suspended;
 }
 EXPORT_SYMBOL(leo_handover_check);
 
 static void
-leo_handover(struct leo *leo)
-{
-	struct sock *sk = LEO_SOCKET(leo);
-	struct tcp_sock *tp = tcp_sk(sk);
-#ifdef LEO_HANDOVER_TIMER_ONLY
-
-	if (tp->snd_cwnd != 0)
-		leo_handover_start(sk);
-	else
-		leo_handover_end(sk, *leo->last_snd_cwnd);
-#else /* LEO_HANDOVER_TIMER_ONLY  */
-	u64 njiffies;
-
-	njiffies = leo_jiffies() % LEO_HANDOVER_INTERVAL;
-	if (njiffies + LEO_HANDOVER_TIME_JITTER >= LEO_HANDOVER_END)
-		leo_handover_end(sk, *leo->last_snd_cwnd);
-	else if (njiffies + LEO_HANDOVER_TIME_JITTER >= LEO_HANDOVER_START)
-		leo_handover_start(sk);
-	else if (tp->snd_cwnd == 0)
-		leo_handover_end(sk, *leo->last_snd_cwnd);
-	else
-		/* already handover ended, and resumed. */
-		DP("LEO[%p]: handover: already handover recovered???", sk);
-#endif /* ! LEO_HANDOVER_TIMER_ONLY  */
-	leo_handover_timer_reset(leo);
-}
-
-__bpf_kfunc static void
-leo_handover_cb(struct timer_list *t)
+leo_trace(struct sock *sk, s32 rtt_us)
 {
-	struct leo *leo = from_timer(leo, t, handover_timer);
-	struct sock *sk = LEO_SOCKET(leo);
-
-	bh_lock_sock(sk);
-	if (sock_owned_by_user(sk)) {
-		sk_reset_timer(sk, &leo->handover_timer, jiffies + 1);
-		DP("LEO[%p]: socket is owned by user\n", sk);
-	} else if (sk->sk_state != TCP_ESTABLISHED)
-		leo_finish(leo);
-	else
-		leo_handover(leo);
-	bh_unlock_sock(sk);
-
-	/* decrement refernce counter incremented in sk_reset_timer(). */
-	sock_put(sk);
+	const struct tcp_sock *tp = tcp_sk(sk);
+	struct leo_trace_record rec;
+
+	rec.time_us = tp->tcp_mstamp;
+	rec.cookie = sock_gen_cookie(sk);
+	rec.pacing_rate = READ_ONCE(sk->sk_pacing_rate);
+	rec.rtt_us = rtt_us;
+	rec.srtt_us = tp->srtt_us >> 3;
+	rec.delivered = tp->delivered;
+	rec.inflight = tcp_packets_in_flight(tp);
+	rec.cwnd = tcp_snd_cwnd(tp);
+	rec.ssthresh = tp->snd_ssthresh;
+	rcu_read_lock();
+	rec.phase_us = leo_phase(leo_schedule_get()) / HZ / NSEC_PER_USEC;
+	rcu_read_unlock();
+	rec.ca_state = inet_csk(sk)->icsk_ca_state;
+	rec.suspended = tcp_snd_cwnd(tp) == 0;
+	rec.pad = 0;
+
+	/* lock-free as the buffer is per-CPU. */
+	relay_write(leo_trace_chan, &rec, sizeof(rec));
 }
 
-__bpf_kfunc void
-leo_init(struct sock *sk, u32 *last_snd_cwnd)
+static void
+leo_hist_update(struct sock *sk, s32 rtt_us)
 {
+	const struct tcp_sock *tp = tcp_sk(sk);
+	struct leo_hist_bin *bin;
 	struct leo *leo;
+	u32 delivered, lost;
+	u64 phase_ms;
 
-	leo = kmalloc(sizeof(*leo), GFP_ATOMIC);
+	rcu_read_lock();
+	leo = leo_lookup(sk);
 	if (leo == NULL) {
-		DP("LEO[%p]: allocation failure\n", sk);
+		rcu_read_unlock();
 		return;
 	}
-	DP("LEO[%p]: allocate: %p\n", sk, leo);
-
-	leo->sock = sk;
-	leo->last_snd_cwnd = last_snd_cwnd;
-
-	timer_setup(&leo->handover_timer, leo_handover_cb, 0);
-	if (is_leo_handover())
-		leo_suspend_transmission(sk);
-	leo_handover_timer_reset(leo);
+	delivered = tp->delivered - leo->last_delivered;
+	lost = tp->lost - leo->last_lost;
+	leo->last_delivered = tp->delivered;
+	leo->last_lost = tp->lost;
+	rcu_read_unlock();
+
+	rcu_read_lock();
+	phase_ms = leo_phase(leo_schedule_get()) / HZ / NSEC_PER_MSEC;
+	rcu_read_unlock();
+
+	/* racy with softirq on the same CPU, but fine for statistics. */
+	bin = get_cpu_ptr(leo_hist) +
+	    min_t(u64, phase_ms / leo_hist_bin_ms, leo_hist_nbins - 1);
+	if (rtt_us > 0) {
+		bin->rtt_sum_us += rtt_us;
+		bin->rtt_cnt++;
+		if (bin->rtt_min_us == 0 || bin->rtt_min_us > rtt_us)
+			bin->rtt_min_us = rtt_us;
+		if (bin->rtt_max_us < rtt_us)
+			bin->rtt_max_us = rtt_us;
+	}
+	bin->lost += lost;
+	bin->delivered_bytes += (u64)delivered * tp->mss_cache;
+	put_cpu_ptr(leo_hist);
 }
-EXPORT_SYMBOL(leo_init);
 
-__bpf_kfunc static void
-leo_finish(struct leo *leo)
+/*
+ * called on every ACK by congestion control algorithms
+ * regardless of handover.
+ */
+void
+leo_acked(struct sock *sk, s32 rtt_us)
 {
+	unsigned int sample;
+	struct leo *leo;
 
-	DP("LEO[%p]: free: %p\n", LEO_SOCKET(leo), leo);
-	kfree(leo);
+	sample = READ_ONCE(leo_trace_sample);
+	if (leo_trace_chan != NULL && sample != 0 &&
+	    this_cpu_inc_return(leo_trace_count) % sample == 0)
+		leo_trace(sk, rtt_us);
+	if (leo_hist != NULL)
+		leo_hist_update(sk, rtt_us);
+	rcu_read_lock();
+	leo = leo_lookup(sk);
+	if (leo != NULL)
+		leo_resume_check(sk, leo);
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL(leo_acked);
+
+/*
+ * the number of windows ended since the epoch in the schedule of a
+ * socket, i.e., an epoch served by a satellite.  this is derived
+ * from the real time in ns, and not from leo_jiffies(), which wraps
+ * every minute, nor from leo_jiffies_base, which is resynchronized
+ * every minute.  a u32 lasts about 2000 years of 15 s intervals.
+ * computed at activation, by the timer, and once the next window
+ * ends, so that ACKs only compare tp->tcp_mstamp.
+ */
+static void
+leo_handover_seq_update(struct leo *leo)
+{
+	const struct leo_schedule *ls;
+	struct leo_schedule lsbuf;
+	u64 now, interval, offset, end;
+	u64 rem;
+
+	now = ktime_get_real_ns();
+	rcu_read_lock();
+	ls = leo_sock_schedule(leo, &lsbuf);
+	interval = div_u64(ls->interval, HZ);
+	offset = div_u64(ls->offset, HZ);
+	end = div_u64(ls->end, HZ);
+	rcu_read_unlock();
+
+	leo->handover_seq = div64_u64_rem(now + offset + interval - end,
+	    interval, &rem);
+	leo->handover_seq_next = tcp_clock_us() +
+	    div_u64(interval - rem, NSEC_PER_USEC);
+}
+
+/* 0 while the socket is not active.  called with the socket locked. */
+u32
+leo_handover_seq(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	struct leo *leo;
+	u32 seq = 0;
+
+	rcu_read_lock();
+	leo = leo_lookup(sk);
+	if (leo != NULL) {
+		if ((s64)(tp->tcp_mstamp - leo->handover_seq_next) >= 0)
+			leo_handover_seq_update(leo);
+		seq = leo->handover_seq;
+	}
+	rcu_read_unlock();
+
+	return seq;
+}
+EXPORT_SYMBOL(leo_handover_seq);
+
+/* in a window or its guard band now. */
+static bool
+leo_guarded(const struct leo *leo)
+{
+	const struct leo_schedule *ls;
+	struct leo_schedule lsbuf;
+	bool ret;
+
+	if (READ_ONCE(leo_outage))
+		return true;
+
+	rcu_read_lock();
+	ls = leo_sock_schedule(leo, &lsbuf);
+	ret = leo_in_guard(ls, leo_phase(ls),
+	    MSEC_TO_LEO_JIFFIES(READ_ONCE(leo_handover_guard_ms)));
+	rcu_read_unlock();
+
+	return ret;
+}
+
+/*
+ * called by congestion control algorithms before reducing ssthresh
+ * and cwnd.  the first reduction around a window is snapshotted.
+ * only leo-cubic undoes as BBR sets cwnd by its own model on every
+ * ACK, i.e., bbr_set_cwnd() would clamp a restored cwnd right away,
+ * and it restores prior_cwnd by itself when leaving recovery.
+ */
+void
+leo_ssthresh(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	struct leo *leo;
+
+	rcu_read_lock();
+	leo = leo_lookup(sk);
+	if (leo != NULL && ! leo->shadow &&
+	    leo->undo_state == LEO_UNDO_NONE &&
+	    (leo->suspended || leo_guarded(leo))) {
+		/* cwnd is zero if suspended. */
+		leo->undo_cwnd = tcp_snd_cwnd(tp) != 0 ?
+		    tcp_snd_cwnd(tp) : *leo->last_snd_cwnd;
+		leo->undo_ssthresh = tp->snd_ssthresh;
+		leo->undo_state = LEO_UNDO_ARMED;
+		DP("LEO[%p]: undo: armed: cwnd: %u, ssthresh: %u\n",
+		    sk, leo->undo_cwnd, leo->undo_ssthresh);
+	}
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL(leo_ssthresh);
+
+/*
+ * called on every ACK not suspended.  true if cwnd and ssthresh are
+ * restored.
+ */
+bool
+leo_undo(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct leo *leo;
+	bool open, ret = false;
+
+	rcu_read_lock();
+	leo = leo_lookup(sk);
+	if (leo == NULL || leo->undo_state == LEO_UNDO_NONE) {
+		rcu_read_unlock();
+		return false;
+	}
+	open = inet_csk(sk)->icsk_ca_state == TCP_CA_Open;
+	switch (leo->undo_state) {
+	case LEO_UNDO_ARMED:
+		if (! open || leo->suspended || leo_guarded(leo))
+			break;
+		leo->undo_delivered = tp->delivered;
+		leo->undo_lost = tp->lost;
+		leo->undo_state = LEO_UNDO_CHECK;
+		break;
+	case LEO_UNDO_CHECK:
+		if (! open || leo->suspended || tp->lost != leo->undo_lost) {
+			/* congestion after all. */
+			DP("LEO[%p]: undo: cancelled\n", sk);
+			leo->undo_state = LEO_UNDO_NONE;
+			break;
+		}
+		if (tp->delivered - leo->undo_delivered < tcp_snd_cwnd(tp))
+			break;
+		tcp_snd_cwnd_set(tp, min(max(tcp_snd_cwnd(tp), leo->undo_cwnd),
+		    tp->snd_cwnd_clamp));
+		tp->snd_ssthresh = max(tp->snd_ssthresh, leo->undo_ssthresh);
+		leo->undo_state = LEO_UNDO_NONE;
+		LEO_STAT_ADD(leo, LEO_STAT_UNDO, 1);
+		DP("LEO[%p]: undo: cwnd: %u, ssthresh: %u\n",
+		    sk, tcp_snd_cwnd(tp), tp->snd_ssthresh);
+		ret = true;
+		break;
+	}
+	rcu_read_unlock();
+
+	return ret;
+}
+EXPORT_SYMBOL(leo_undo);
+
+/*
+ * the total time suspended by finished windows.  congestion control
+ * shifts its epoch by the difference as in application idle.
+ */
+u32
+leo_suspended_jiffies(struct sock *sk)
+{
+	struct leo *leo;
+	u32 ret = 0;
+
+	rcu_read_lock();
+	leo = leo_lookup(sk);
+	if (leo != NULL)
+		ret = READ_ONCE(leo->suspended_jiffies);
+	rcu_read_unlock();
+
+	return ret;
+}
+EXPORT_SYMBOL(leo_suspended_jiffies);
+
+/*
+ * true if an RTT sample was sent or acked in a guard band around a
+ * window.  a shadow socket only counts it.
+ */
+bool
+leo_rtt_guarded(struct sock *sk, s32 rtt_us)
+{
+	const struct leo_schedule *ls;
+	struct leo_schedule lsbuf;
+	struct leo *leo;
+	u64 njiffies, rtt, guard;
+	unsigned int guard_ms;
+	bool ret;
+
+	guard_ms = READ_ONCE(leo_handover_guard_ms);
+	if (guard_ms == 0 || rtt_us < 0)
+		return false;
+
+	rcu_read_lock();
+	/* not yet active sockets follow the global schedule. */
+	leo = leo_lookup(sk);
+	ls = leo_sock_schedule(leo, &lsbuf);
+	njiffies = leo_phase(ls);
+	rtt = ((u64)rtt_us * NSEC_PER_USEC * HZ) % ls->interval;
+	guard = MSEC_TO_LEO_JIFFIES(guard_ms);
+	ret = READ_ONCE(leo_outage) ||
+	    leo_in_guard(ls, njiffies, guard) ||
+	    leo_in_guard(ls, (njiffies + ls->interval - rtt) % ls->interval,
+	    guard);
+	if (ret) {
+		this_cpu_inc(leo_guard_stats.samples[leo != NULL &&
+		    leo->shadow]);
+		if (leo != NULL && leo->shadow)
+			ret = false;
+	}
+	rcu_read_unlock();
+
+	return ret;
+}
+EXPORT_SYMBOL(leo_rtt_guarded);
+
+/*
+ * called on every congestion control event regardless of handover.
+ */
+void
+leo_cwnd_event(struct sock *sk, enum tcp_ca_event event)
+{
+	struct leo *leo;
+
+	if (event != CA_EVENT_LOSS && event != CA_EVENT_TX_START)
+		return;
+
+	rcu_read_lock();
+	leo = leo_lookup(sk);
+	if (leo == NULL) {
+		rcu_read_unlock();
+		return;
+	}
+	/* called before the segment is counted. */
+	if (leo->resume_ns != 0)
+		leo_resume_record(sk, leo, event == CA_EVENT_LOSS ?
+		    LEO_RESUME_RTO : leo->resume_cause);
+	if (event == CA_EVENT_LOSS) {
+		if (leo->suspended)
+			leo->win_rto++;
+	} else if (READ_ONCE(leo_tx_start) && ! is_leo_suspended(sk, leo) &&
+	    leo_policy_decide(sk, leo, LEO_POLICY_TX_START,
+	    is_leo_handover(leo))) {
+		/*
+		 * data written in a window by an idle application must
+		 * not go into the outage.  this is called on the first
+		 * segment, and the rest waits for the end of the window.
+		 * resumption is left to the timer as this is in the
+		 * middle of transmission.
+		 */
+		DP("LEO[%p]: handover: transmission started in window\n", sk);
+		leo_handover_start(sk, leo);
+	}
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL(leo_cwnd_event);
+
+static void
+leo_handover(struct leo *leo)
+{
+	struct sock *sk = LEO_SOCKET(leo);
+	const struct leo_schedule *ls;
+	struct leo_schedule lsbuf;
+	u64 njiffies;
+	bool stalled;
+
+	stalled = tcp_snd_cwnd(tcp_sk(sk)) == 0;
+	rcu_read_lock();
+	ls = leo_sock_schedule(leo, &lsbuf);
+	njiffies = leo_phase(ls);
+	if (READ_ONCE(leo_outage))
+		leo_handover_start(sk, leo);
+#ifdef LEO_HANDOVER_TIMER_ONLY
+	/* the timer may be kicked earlier by a schedule change. */
+	else if (! is_leo_suspended(sk, leo)) {
+		if (njiffies + LEO_HANDOVER_TIME_JITTER >= ls->start &&
+		    njiffies < ls->end)
+			leo_handover_start(sk, leo);
+	} else if (njiffies + LEO_HANDOVER_TIME_JITTER >= ls->end ||
+	    njiffies + LEO_HANDOVER_TIME_JITTER < ls->start)
+		leo_handover_end(sk, leo, *leo->last_snd_cwnd,
+		    LEO_RESUME_TIMER);
+#else /* LEO_HANDOVER_TIMER_ONLY  */
+	else if (leo_policy_decide(sk, leo, LEO_POLICY_TIMER,
+	    njiffies + LEO_HANDOVER_TIME_JITTER >= ls->start &&
+	    njiffies + LEO_HANDOVER_TIME_JITTER < ls->end)) {
+		if (! is_leo_suspended(sk, leo))
+			leo_handover_start(sk, leo);
+	} else if (is_leo_suspended(sk, leo))
+		leo_handover_end(sk, leo, *leo->last_snd_cwnd,
+		    LEO_RESUME_TIMER);
+	else if (leo->notify && ! leo->notified &&
+	    njiffies + leo_notify_lead(ls) + LEO_HANDOVER_TIME_JITTER >=
+	    ls->start)
+		leo_notify(sk, leo, LEO_NOTIFY_SUSPEND,
+		    div_u64(ls->start - njiffies, NSEC_PER_MSEC * HZ));
+	else
+		/* already handover ended, and resumed. */
+		DP("LEO[%p]: handover: already handover recovered???", sk);
+#endif /* ! LEO_HANDOVER_TIMER_ONLY  */
+	rcu_read_unlock();
+	/* the schedule may have changed. */
+	leo_handover_seq_update(leo);
+	/* no ACK comes to clock out data queued while suspended. */
+	if (stalled && tcp_snd_cwnd(tcp_sk(sk)) != 0) {
+		leo_push(sk);
+		leo_resume_check(sk, leo);
+	}
+	leo_handover_timer_reset(leo);
+}
+
+/* must be called with the socket locked. */
+static bool
+leo_egress_match(struct sock *sk)
+{
+	const struct dst_entry *dst;
+	unsigned int i, n;
+	int ifindex = 0;
+
+	n = min_t(unsigned int, READ_ONCE(leo_nifindex), LEO_IFINDEX_MAX);
+	if (n == 0)
+		return true;
+
+	rcu_read_lock();
+	dst = __sk_dst_get(sk);
+	if (dst != NULL && dst->dev != NULL)
+		ifindex = dst->dev->ifindex;
+	rcu_read_unlock();
+	for (i = 0; i < n; i++)
+		if (READ_ONCE(leo_ifindex[i]) == ifindex)
+			return true;
+	return false;
+}
+
+/*
+ * stop LEO on a socket, and resume transmission if suspended.
+ * the memory is freed by leo_finish() in the timer as the timer
+ * may be running now.
+ */
+static void
+leo_detach(struct sock *sk, struct leo *leo)
+{
+
+	/* resumption may re-enter via CA_EVENT_TX_START. */
+	leo->released = true;
+	if (is_leo_suspended(sk, leo))
+		leo_handover_end(sk, leo, *leo->last_snd_cwnd,
+		    LEO_RESUME_NONE);
+}
+
+/* nothing has been sent nor is in flight for leo_idle_ms. */
+static bool
+leo_idle(struct sock *sk, struct leo *leo)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	unsigned int idle_ms;
+
+	/* subscribers expect the advance notice even while idle. */
+	idle_ms = READ_ONCE(leo_idle_ms);
+	if (idle_ms == 0 || READ_ONCE(leo->notify) ||
+	    is_leo_suspended(sk, leo) || tp->packets_out != 0)
+		return false;
+	return (s32)(tcp_jiffies32 - tp->lsndtime) >
+	    (s32)msecs_to_jiffies(idle_ms);
+}
+
+/*
+ * pick up a subscription changed by leo_genl_subscribe(), which does
+ * not hold the socket lock.  called with the socket locked.
+ */
+static void
+leo_notify_update(struct sock *sk, struct leo *leo)
+{
+	struct leo_sock *lsk;
+
+	rcu_read_lock();
+	lsk = leo_sock_lookup(sk);
+	if (lsk != NULL)
+		WRITE_ONCE(leo->notify, READ_ONCE(lsk->notify));
+	rcu_read_unlock();
+}
+
+__bpf_kfunc static void
+leo_handover_cb(struct timer_list *t)
+{
+	struct leo *leo = from_timer(leo, t, handover_timer);
+	struct sock *sk = LEO_SOCKET(leo);
+
+	bh_lock_sock(sk);
+	if (leo->released)
+		leo_finish(leo);
+	else if (sock_owned_by_user(sk)) {
+		sk_reset_timer(sk, &leo->handover_timer, jiffies + 1);
+		DP("LEO[%p]: socket is owned by user\n", sk);
+	} else if (sk->sk_state != TCP_ESTABLISHED) {
+		/* resume, and give back the cwnd and the send buffer. */
+		leo_detach(sk, leo);
+		leo_finish(leo);
+	} else if (! leo_egress_match(sk)) {
+		DP("LEO[%p]: egress changed\n", sk);
+		leo_sock_detach(sk);
+		leo_detach(sk, leo);
+		leo_finish(leo);
+	} else {
+		leo_notify_update(sk, leo);
+		if (leo_idle(sk, leo)) {
+			/* activated again when sending. */
+			DP("LEO[%p]: idle\n", sk);
+			leo_detach(sk, leo);
+			leo_finish(leo);
+		} else
+			leo_handover(leo);
+	}
+	bh_unlock_sock(sk);
+
+	/* decrement refernce counter incremented in sk_reset_timer(). */
+	sock_put(sk);
+}
+
+static void
+leo_sock_daddr(const struct sock *sk, struct in6_addr *addr)
+{
+
+#if IS_ENABLED(CONFIG_IPV6)
+	if (sk->sk_family == AF_INET6) {
+		*addr = sk->sk_v6_daddr;
+		return;
+	}
+#endif /* CONFIG_IPV6 */
+	ipv6_addr_set_v4mapped(sk->sk_daddr, addr);
+}
+
+/*
+ * copy the longest matching route of the peer if any.  gen is read
+ * first so that a change meanwhile is looked up again later.
+ */
+static bool
+leo_route_lookup(const struct sock *sk, struct leo_route *match,
+    unsigned int *gen)
+{
+	struct leo_route *r;
+	struct in6_addr addr;
+	bool found = false;
+
+	*gen = READ_ONCE(leo_route_gen);
+	smp_rmb();
+	if (list_empty(&leo_routes))
+		return false;
+
+	leo_sock_daddr(sk, &addr);
+	rcu_read_lock();
+	list_for_each_entry_rcu(r, &leo_routes, list) {
+		if (ipv6_prefix_equal(&addr, &r->prefix, r->plen)) {
+			*match = *r;
+			found = true;
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	return found;
+}
+
+/* whether the socket should run LEO, and its route if any. */
+static bool
+leo_eligible(struct sock *sk, struct leo_route *route, bool *routed,
+    unsigned int *gen)
+{
+
+	if (! leo_egress_match(sk)) {
+		DP("LEO[%p]: not egressing LEO interfaces\n", sk);
+		return false;
+	}
+	*routed = leo_route_lookup(sk, route, gen);
+	if (*routed && route->mode == LEO_ROUTE_DISABLE) {
+		DP("LEO[%p]: disabled by route\n", sk);
+		return false;
+	}
+	return true;
+}
+
+/* cache the schedule adjustments of the route in the state. */
+static void
+leo_route_set(struct leo *leo, const struct leo_route *route, bool routed,
+    unsigned int gen)
+{
+
+	leo->route_gen = gen;
+	leo->route_flags = 0;
+	if (routed) {
+		leo->route_flags = route->flags;
+		leo->route_start_ms = route->start_ms;
+		leo->route_duration_ms = route->duration_ms;
+		leo->route_offset_ms = route->offset_ms;
+	}
+}
+
+/*
+ * allocate the state, and arm the timer.  this is deferred until
+ * the socket actually sends, i.e., the first cwnd-limited ACK or
+ * CA_EVENT_TX_START, so that idle connections cost nothing.
+ */
+static struct leo *
+leo_activate(struct sock *sk, u32 *last_snd_cwnd)
+{
+	struct leo_route route;
+	struct leo_sock *lsk;
+	struct leo *leo;
+	unsigned int gen;
+	bool routed;
+
+	/* freed only with the socket locked. */
+	rcu_read_lock();
+	lsk = leo_sock_lookup(sk);
+	rcu_read_unlock();
+	/* ACKs do not look up egress and routes again once detached. */
+	if (lsk == NULL || lsk->detached)
+		return NULL;
+	if (! leo_eligible(sk, &route, &routed, &gen)) {
+		lsk->detached = true;
+		return NULL;
+	}
+
+	leo = kmalloc(sizeof(*leo), GFP_ATOMIC);
+	if (leo == NULL) {
+		DP("LEO[%p]: allocation failure\n", sk);
+		return NULL;
+	}
+	DP("LEO[%p]: allocate: %p\n", sk, leo);
+
+	leo->sock = sk;
+	leo->last_snd_cwnd = last_snd_cwnd;
+	leo->nsuspend = 0;
+	leo->nresume = 0;
+	leo->last_delivered = tcp_sk(sk)->delivered;
+	leo->last_lost = tcp_sk(sk)->lost;
+	leo->bytes_acked = tcp_sk(sk)->bytes_acked;
+	leo->total_retrans = tcp_sk(sk)->total_retrans;
+	leo->start = jiffies;
+	leo->shadow = lsk->shadow;
+	leo->suspended = false;
+	leo->released = false;
+	leo->notify = false;
+	leo->notified = false;
+	leo->resume_ns = 0;
+	leo->resume_cnt = 0;
+	leo->resume_sum_us = 0;
+	leo->resume_max_us = 0;
+	leo->suspended_jiffies = 0;
+	leo->win_pacing_rate = 0;
+	leo->undo_state = LEO_UNDO_NONE;
+	leo->undo_cwnd = 0;
+	leo->undo_ssthresh = 0;
+	leo->win_sndbuf = 0;
+	leo_route_set(leo, &route, routed, gen);
+	leo_handover_seq_update(leo);
+	timer_setup(&leo->handover_timer, leo_handover_cb, 0);
+
+	/* walkers may arm the timer as soon as this is published. */
+	if (rhltable_insert(&leo_hash, &leo->node, leo_hash_params) != 0) {
+		DP("LEO[%p]: insertion failure\n", sk);
+		kfree(leo);
+		return NULL;
+	}
+	spin_lock_bh(&leo_list_lock);
+	hlist_add_head_rcu(&leo->list, &leo_list);
+	spin_unlock_bh(&leo_list_lock);
+
+	/* after published, pairs with leo_genl_subscribe(). */
+	smp_mb();
+	WRITE_ONCE(leo->notify, READ_ONCE(lsk->notify));
+
+	if (leo_policy_decide(sk, leo, LEO_POLICY_INIT, is_leo_handover(leo)))
+		leo_handover_start(sk, leo);
+	leo_handover_timer_reset(leo);
+
+	return leo;
+}
+
+/*
+ * returns false if the socket does not run LEO, and congestion
+ * control algorithms must not call any other LEO functions then.
+ * the state is allocated later by leo_activate().
+ */
+__bpf_kfunc bool
+leo_init(struct sock *sk, u32 *last_snd_cwnd)
+{
+	struct leo_route route;
+	struct leo_sock *lsk;
+	unsigned int gen;
+	bool routed;
+
+	(void)last_snd_cwnd;
+	if (! leo_eligible(sk, &route, &routed, &gen))
+		return false;
+
+	lsk = kmalloc(sizeof(*lsk), GFP_ATOMIC);
+	if (lsk == NULL) {
+		DP("LEO[%p]: allocation failure\n", sk);
+		return false;
+	}
+	lsk->sk = sk;
+	if (routed && route.mode == LEO_ROUTE_SHADOW)
+		lsk->shadow = true;
+	else
+		lsk->shadow =
+		    get_random_u32_below(100) < leo_shadow_percent;
+	lsk->notify = false;
+	lsk->detached = false;
+	if (rhashtable_insert_fast(&leo_sock_hash, &lsk->hash,
+	    leo_sock_hash_params) != 0) {
+		DP("LEO[%p]: insertion failure\n", sk);
+		kfree(lsk);
+		return false;
+	}
+	atomic64_inc(&leo_stats[lsk->shadow][LEO_STAT_SOCKETS]);
+
+	return true;
+}
+EXPORT_SYMBOL(leo_init);
+
+/*
+ * re-evaluate whether a socket given LEO by leo_init() runs it, e.g.,
+ * after its route changed, and activate it as it is sending.  called
+ * on CA_EVENT_TX_START and CA_EVENT_LOSS with the socket locked, and
+ * only for sockets given LEO.  a socket detached here runs the plain
+ * algorithm until its egress and route allow LEO again.
+ */
+void
+leo_reevaluate(struct sock *sk, u32 *last_snd_cwnd)
+{
+	struct leo_sock *lsk;
+	struct leo *leo;
+
+	/* neither is freed while the socket is locked. */
+	rcu_read_lock();
+	lsk = leo_sock_lookup(sk);
+	leo = leo_lookup(sk);
+	rcu_read_unlock();
+	if (lsk == NULL)
+		return;
+
+	if (! leo_egress_match(sk)) {
+		lsk->detached = true;
+		if (leo != NULL) {
+			DP("LEO[%p]: egress changed\n", sk);
+			leo_detach(sk, leo);
+			/* the timer is pending unless running now. */
+			mod_timer_pending(&leo->handover_timer, jiffies);
+		}
+		return;
+	}
+	if (leo == NULL) {
+		/* detached again by leo_activate() unless eligible. */
+		lsk->detached = false;
+		(void)leo_activate(sk, last_snd_cwnd);
+		return;
+	}
+	/*
+	 * the cached route is looked up again only if routes changed.
+	 * the shadow role is kept, and the schedule is not changed in
+	 * a window.
+	 */
+	if (leo->route_gen != READ_ONCE(leo_route_gen) &&
+	    ! is_leo_suspended(sk, leo)) {
+		struct leo_route route;
+		unsigned int gen;
+		bool routed;
+
+		routed = leo_route_lookup(sk, &route, &gen);
+		if (routed && route.mode == LEO_ROUTE_DISABLE) {
+			DP("LEO[%p]: disabled by route\n", sk);
+			lsk->detached = true;
+			leo_detach(sk, leo);
+			mod_timer_pending(&leo->handover_timer, jiffies);
+			return;
+		}
+		leo_route_set(leo, &route, routed, gen);
+		leo_handover_seq_update(leo);
+	}
+}
+EXPORT_SYMBOL(leo_reevaluate);
+
+/*
+ * called when the congestion control is released, i.e., changed
+ * or the socket is destroyed.  cwnd is handed back to the next
+ * algorithm without sending as the socket may be being destroyed.
+ */
+void
+leo_release(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct leo *leo;
+
+	rcu_read_lock();
+	leo = leo_lookup(sk);
+	rcu_read_unlock();
+	if (leo != NULL) {
+		DP("LEO[%p]: release\n", sk);
+		leo->released = true;
+		if (! leo->shadow && tcp_snd_cwnd(tp) == 0)
+			tcp_snd_cwnd_set(tp, max(1U, *leo->last_snd_cwnd));
+		mod_timer_pending(&leo->handover_timer, jiffies);
+	}
+	leo_sock_del(sk);
+}
+EXPORT_SYMBOL(leo_release);
+
+__bpf_kfunc static void
+leo_finish(struct leo *leo)
+{
+	struct sock *sk = LEO_SOCKET(leo);
+	const struct tcp_sock *tp = tcp_sk(sk);
+
+	DP("LEO[%p]: free: %p\n", sk, leo);
+
+	if (leo->suspended)
+		leo_window_close(sk, leo);
+	LEO_STAT_ADD(leo, LEO_STAT_BYTES, tp->bytes_acked - leo->bytes_acked);
+	LEO_STAT_ADD(leo, LEO_STAT_RETRANS_TOTAL,
+	    tp->total_retrans - leo->total_retrans);
+	LEO_STAT_ADD(leo, LEO_STAT_DURATION_MS,
+	    jiffies_to_msecs(jiffies - leo->start));
+
+	rhltable_remove(&leo_hash, &leo->node, leo_hash_params);
+	spin_lock_bh(&leo_list_lock);
+	hlist_del_rcu(&leo->list);
+	spin_unlock_bh(&leo_list_lock);
+
+	/* walkers of leo_list may still refer to this. */
+	kfree_rcu(leo, rcu);
+}
+
+/*
+ * /proc/tcp_leo/sockets dumps all LEO sockets without touching
+ * socket locks nor inet_diag.  values are racy snapshots, and
+ * this is fine for monitoring.  tcp sockets are allocated with
+ * SLAB_TYPESAFE_BY_RCU, and a socket is thus valid memory under
+ * rcu_read_lock() even if it is just being freed.
+ */
+/*
+ * leo_hash is walked with rhashtable_walk_*(), and a read resumes
+ * where the last one stopped instead of walking from the head, i.e.,
+ * a dump is O(n) rather than O(n^2).  sockets added or removed
+ * meanwhile, or a resize, may skip or repeat some.
+ */
+struct leo_iter_state {
+	struct rhashtable_iter hti;
+	loff_t pos;			/* of the last one walked */
+};
+
+static struct leo *
+leo_seq_walk(struct leo_iter_state *st)
+{
+	struct leo *leo;
+
+	for (;;) {
+		leo = rhashtable_walk_next(&st->hti);
+		if (! IS_ERR(leo))
+			return leo;
+		/* resized, and continue from the new table. */
+		if (PTR_ERR(leo) != -EAGAIN)
+			return NULL;
+	}
+}
+
+static void
+leo_seq_rewind(struct leo_iter_state *st)
+{
+
+	rhashtable_walk_exit(&st->hti);
+	rhltable_walk_enter(&leo_hash, &st->hti);
+	st->pos = 0;
+}
+
+static void *
+leo_seq_start(struct seq_file *seq, loff_t *pos)
+	__acquires(RCU)
+{
+	struct leo_iter_state *st = seq->private;
+	struct leo *leo;
+
+	if (*pos != st->pos)
+		leo_seq_rewind(st);
+	/* takes rcu_read_lock(). */
+	rhashtable_walk_start(&st->hti);
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+	if (*pos == st->pos) {
+		leo = rhashtable_walk_peek(&st->hti);
+		return IS_ERR(leo) ? leo_seq_walk(st) : leo;
+	}
+
+	/* seeked, and walk from the head. */
+	do {
+		leo = leo_seq_walk(st);
+		st->pos++;
+	} while (leo != NULL && st->pos < *pos);
+	return leo;
+}
+
+static void *
+leo_seq_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	struct leo_iter_state *st = seq->private;
+
+	st->pos = ++*pos;
+	return leo_seq_walk(st);
+}
+
+static void
+leo_seq_stop(struct seq_file *seq, void *v)
+	__releases(RCU)
+{
+	struct leo_iter_state *st = seq->private;
+
+	rhashtable_walk_stop(&st->hti);
+}
+
+static void
+leo_seq_show_addr(struct seq_file *seq, const struct sock *sk)
+{
+
+#if IS_ENABLED(CONFIG_IPV6)
+	if (sk->sk_family == AF_INET6) {
+		seq_printf(seq, "[%pI6c]:%u [%pI6c]:%u",
+		    &sk->sk_v6_rcv_saddr, sk->sk_num,
+		    &sk->sk_v6_daddr, ntohs(sk->sk_dport));
+		return;
+	}
+#endif /* CONFIG_IPV6 */
+	seq_printf(seq, "%pI4:%u %pI4:%u",
+	    &sk->sk_rcv_saddr, sk->sk_num,
+	    &sk->sk_daddr, ntohs(sk->sk_dport));
+}
+
+static int
+leo_seq_show(struct seq_file *seq, void *v)
+{
+	const struct tcp_sock *tp;
+	struct leo *leo;
+	struct sock *sk;
+	u32 cnt;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_puts(seq, "local remote state ca_state cwnd ssthresh "
+		    "last_cwnd inflight srtt_us min_rtt_us delivered lost "
+		    "retrans pacing_rate shadow suspended nsuspend nresume "
+		    "resume_avg_us resume_max_us\n");
+		return 0;
+	}
+
+	leo = v;
+	sk = LEO_SOCKET(leo);
+	tp = tcp_sk(sk);
+
+	leo_seq_show_addr(seq, sk);
+	cnt = READ_ONCE(leo->resume_cnt);
+	seq_printf(seq,
+	    " %u %u %u %u %u %u %u %u %u %u %u %lu %u %u %u %u %llu %u\n",
+	    READ_ONCE(sk->sk_state), READ_ONCE(inet_csk(sk)->icsk_ca_state),
+	    READ_ONCE(tp->snd_cwnd), READ_ONCE(tp->snd_ssthresh),
+	    READ_ONCE(*leo->last_snd_cwnd), tcp_packets_in_flight(tp),
+	    READ_ONCE(tp->srtt_us) >> 3, tcp_min_rtt(tp),
+	    READ_ONCE(tp->delivered), READ_ONCE(tp->lost),
+	    READ_ONCE(tp->total_retrans), READ_ONCE(sk->sk_pacing_rate),
+	    leo->shadow, READ_ONCE(leo->suspended),
+	    READ_ONCE(leo->nsuspend), READ_ONCE(leo->nresume),
+	    cnt != 0 ? div_u64(READ_ONCE(leo->resume_sum_us), cnt) : 0,
+	    READ_ONCE(leo->resume_max_us));
+	return 0;
+}
+
+static const struct seq_operations leo_seq_ops = {
+	.start	= leo_seq_start,
+	.next	= leo_seq_next,
+	.stop	= leo_seq_stop,
+	.show	= leo_seq_show,
+};
+
+static int
+leo_seq_open(struct inode *inode, struct file *file)
+{
+	struct leo_iter_state *st;
+
+	st = __seq_open_private(file, &leo_seq_ops, sizeof(*st));
+	if (st == NULL)
+		return -ENOMEM;
+	rhltable_walk_enter(&leo_hash, &st->hti);
+	st->pos = 0;
+	return 0;
+}
+
+static int
+leo_seq_release(struct inode *inode, struct file *file)
+{
+	struct seq_file *seq = file->private_data;
+	struct leo_iter_state *st = seq->private;
+
+	rhashtable_walk_exit(&st->hti);
+	return seq_release_private(inode, file);
+}
+
+static const struct proc_ops leo_seq_proc_ops = {
+	.proc_open	= leo_seq_open,
+	.proc_read	= seq_read,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= leo_seq_release,
+};
+
+/* /proc/tcp_leo/histogram shows a bin per line summing up all CPUs. */
+static void *
+leo_hist_seq_start(struct seq_file *seq, loff_t *pos)
+{
+
+	if (*pos > leo_hist_nbins)
+		return NULL;
+	return *pos == 0 ? SEQ_START_TOKEN : (void *)(uintptr_t)*pos;
+}
+
+static void *
+leo_hist_seq_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+
+	++*pos;
+	return leo_hist_seq_start(seq, pos);
+}
+
+static void
+leo_hist_seq_stop(struct seq_file *seq, void *v)
+{
+}
+
+static int
+leo_hist_seq_show(struct seq_file *seq, void *v)
+{
+	struct leo_hist_bin sum, *bin;
+	unsigned int i;
+	int cpu;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_puts(seq, "phase_ms rtt_cnt rtt_avg_us rtt_min_us "
+		    "rtt_max_us lost delivered_bytes\n");
+		return 0;
+	}
+
+	i = (uintptr_t)v - 1;
+	memset(&sum, 0, sizeof(sum));
+	for_each_possible_cpu(cpu) {
+		bin = per_cpu_ptr(leo_hist, cpu) + i;
+		sum.rtt_sum_us += bin->rtt_sum_us;
+		sum.rtt_cnt += bin->rtt_cnt;
+		if (bin->rtt_min_us != 0 &&
+		    (sum.rtt_min_us == 0 || sum.rtt_min_us > bin->rtt_min_us))
+			sum.rtt_min_us = bin->rtt_min_us;
+		if (sum.rtt_max_us < bin->rtt_max_us)
+			sum.rtt_max_us = bin->rtt_max_us;
+		sum.lost += bin->lost;
+		sum.delivered_bytes += bin->delivered_bytes;
+	}
+	seq_printf(seq, "%u %u %llu %u %u %u %llu\n",
+	    i * leo_hist_bin_ms, sum.rtt_cnt,
+	    sum.rtt_cnt != 0 ? div_u64(sum.rtt_sum_us, sum.rtt_cnt) : 0,
+	    sum.rtt_min_us, sum.rtt_max_us, sum.lost, sum.delivered_bytes);
+	return 0;
+}
+
+static const struct seq_operations leo_hist_seq_ops = {
+	.start	= leo_hist_seq_start,
+	.next	= leo_hist_seq_next,
+	.stop	= leo_hist_seq_stop,
+	.show	= leo_hist_seq_show,
+};
+
+static int
+leo_hist_init(void)
+{
+
+	if (leo_hist_bin_ms == 0)
+		return 0;
+	/* phases beyond the interval at load time fall in the last bin. */
+	if (leo_hist_bin_ms > LEO_HANDOVER_INTERVAL_MS)
+		leo_hist_bin_ms = LEO_HANDOVER_INTERVAL_MS;
+	leo_hist_nbins = DIV_ROUND_UP(LEO_HANDOVER_INTERVAL_MS,
+	    leo_hist_bin_ms);
+	leo_hist = __alloc_percpu(sizeof(*leo_hist) * leo_hist_nbins,
+	    __alignof__(*leo_hist));
+	if (leo_hist == NULL)
+		return -ENOMEM;
+	if (proc_create_seq("histogram", 0444, leo_proc_dir,
+	    &leo_hist_seq_ops) == NULL) {
+		free_percpu(leo_hist);
+		leo_hist = NULL;
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static void
+leo_hist_finish(void)
+{
+
+	/* proc entries are removed with leo_proc_dir. */
+	free_percpu(leo_hist);
+}
+
+static int
+leo_routes_show(struct seq_file *seq, void *v)
+{
+	const struct leo_route *r;
+
+	seq_puts(seq, "prefix mode start_ms duration_ms offset_ms\n");
+	rcu_read_lock();
+	list_for_each_entry_rcu(r, &leo_routes, list) {
+		if (ipv6_addr_v4mapped(&r->prefix) && r->plen >= 96)
+			seq_printf(seq, "%pI4/%u", &r->prefix.s6_addr32[3],
+			    r->plen - 96);
+		else
+			seq_printf(seq, "%pI6c/%u", &r->prefix, r->plen);
+		seq_printf(seq, " %s", leo_route_mode_names[r->mode]);
+		if (r->flags & LEO_ROUTE_F_START)
+			seq_printf(seq, " %u", r->start_ms);
+		else
+			seq_puts(seq, " -");
+		if (r->flags & LEO_ROUTE_F_DURATION)
+			seq_printf(seq, " %u", r->duration_ms);
+		else
+			seq_puts(seq, " -");
+		if (r->flags & LEO_ROUTE_F_OFFSET)
+			seq_printf(seq, " %d\n", r->offset_ms);
+		else
+			seq_puts(seq, " -\n");
+	}
+	rcu_read_unlock();
+	return 0;
+}
+
+static s64
+leo_stat_read(int shadow, int stat)
+{
+	s64 n;
+	int cpu;
+
+	n = atomic64_read(&leo_stats[shadow][stat]);
+	if (stat == LEO_STAT_GUARD)
+		for_each_possible_cpu(cpu)
+			n += per_cpu(leo_guard_stats, cpu).samples[shadow];
+	return n;
+}
+
+static int
+leo_stats_show(struct seq_file *seq, void *v)
+{
+	int i;
+
+	seq_puts(seq, "name active shadow\n");
+	for (i = 0; i < LEO_STAT_MAX; i++)
+		seq_printf(seq, "%s %lld %lld\n", leo_stat_names[i],
+		    leo_stat_read(0, i), leo_stat_read(1, i));
+	return 0;
+}
+
+static int
+leo_resume_show(struct seq_file *seq, void *v)
+{
+	u64 cnt;
+	int i, j;
+
+	seq_puts(seq, "cause count sum_us");
+	for (j = 0; j < LEO_RESUME_NBUCKETS - 1; j++)
+		seq_printf(seq, " <%ums", 1U << j);
+	seq_printf(seq, " >=%ums\n", 1U << (j - 1));
+	for (i = LEO_RESUME_NONE + 1; i < LEO_RESUME_MAX; i++) {
+		cnt = 0;
+		for (j = 0; j < LEO_RESUME_NBUCKETS; j++)
+			cnt += atomic64_read(&leo_resume_hist[i][j]);
+		seq_printf(seq, "%s %llu %lld", leo_resume_names[i], cnt,
+		    atomic64_read(&leo_resume_sum_us[i]));
+		for (j = 0; j < LEO_RESUME_NBUCKETS; j++)
+			seq_printf(seq, " %lld",
+			    atomic64_read(&leo_resume_hist[i][j]));
+		seq_putc(seq, '\n');
+	}
+	return 0;
+}
+
+static int
+leo_hash_init(void)
+{
+	int ret;
+
+	ret = rhltable_init(&leo_hash, &leo_hash_params);
+	if (ret < 0)
+		return ret;
+	ret = rhashtable_init(&leo_sock_hash, &leo_sock_hash_params);
+	if (ret < 0)
+		rhltable_destroy(&leo_hash);
+	return ret;
+}
+
+static void
+leo_hash_finish(void)
+{
+
+	rhashtable_destroy(&leo_sock_hash);
+	rhltable_destroy(&leo_hash);
+}
+
+static int
+leo_proc_init(void)
+{
+
+	leo_proc_dir = proc_mkdir("tcp_leo", NULL);
+	if (leo_proc_dir == NULL)
+		return -ENOMEM;
+	if (proc_create("sockets", 0444, leo_proc_dir,
+	    &leo_seq_proc_ops) == NULL ||
+	    proc_create_single("stats", 0444, leo_proc_dir,
+	    leo_stats_show) == NULL ||
+	    proc_create_single("routes", 0444, leo_proc_dir,
+	    leo_routes_show) == NULL ||
+	    proc_create_single("resume", 0444, leo_proc_dir,
+	    leo_resume_show) == NULL) {
+		proc_remove(leo_proc_dir);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static void
+leo_proc_finish(void)
+{
+
+	proc_remove(leo_proc_dir);
+}
+
+/*
+ * let all sockets reconsider suspension and timers as soon as
+ * possible.  a timer not pending is never armed because its
+ * struct leo may be being freed.
+ */
+static void
+leo_kick(void)
+{
+	struct leo *leo;
+
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(leo, &leo_list, list)
+		mod_timer_pending(&leo->handover_timer, jiffies);
+	rcu_read_unlock();
+}
+
+static void
+leo_shared_update(void)
+{
+	struct leo_shared_page *sp;
+	const struct leo_schedule *ls;
+	u64 now, phase, base;
+
+	spin_lock_bh(&leo_shared_lock);
+	sp = leo_shared;
+	if (sp == NULL) {
+		spin_unlock_bh(&leo_shared_lock);
+		return;
+	}
+	WRITE_ONCE(sp->seq, sp->seq + 1);
+	smp_wmb();
+
+	rcu_read_lock();
+	ls = leo_schedule_get();
+	now = ktime_get_real_ns();
+	phase = leo_phase(ls) / HZ;
+	base = now - phase;
+	if (phase > ls->end / HZ)
+		base += ls->interval / HZ;
+	sp->time_base_ns = now - phase;
+	sp->interval_ns = ls->interval / HZ;
+	sp->start_ns = base + ls->start / HZ;
+	sp->end_ns = base + ls->end / HZ;
+	sp->outage = READ_ONCE(leo_outage);
+	rcu_read_unlock();
+
+	smp_wmb();
+	WRITE_ONCE(sp->seq, sp->seq + 1);
+	spin_unlock_bh(&leo_shared_lock);
+}
+
+static int
+leo_shared_mmap(struct file *file, struct vm_area_struct *vma)
+{
+
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vm_flags_clear(vma, VM_MAYWRITE);
+	/* the page is referenced, and outlives the module if mapped. */
+	return vm_insert_page(vma, vma->vm_start, virt_to_page(leo_shared));
+}
+
+static const struct file_operations leo_shared_fops = {
+	.owner	= THIS_MODULE,
+	.mmap	= leo_shared_mmap,
+};
+
+static struct miscdevice leo_shared_dev = {
+	.minor	= MISC_DYNAMIC_MINOR,
+	.name	= "tcp_leo",
+	.fops	= &leo_shared_fops,
+	.mode	= 0444,
+};
+
+static int
+leo_shared_init(void)
+{
+	struct leo_shared_page *sp;
+	int error;
+
+	sp = (struct leo_shared_page *)get_zeroed_page(GFP_KERNEL);
+	if (sp == NULL)
+		return -ENOMEM;
+	sp->version = LEO_SHARED_VERSION;
+	error = misc_register(&leo_shared_dev);
+	if (error != 0) {
+		free_page((unsigned long)sp);
+		return error;
+	}
+	leo_shared = sp;
+	leo_shared_update();
+
+	return 0;
+}
+
+static void
+leo_shared_finish(void)
+{
+	struct leo_shared_page *sp = leo_shared;
+
+	misc_deregister(&leo_shared_dev);
+	spin_lock_bh(&leo_shared_lock);
+	leo_shared = NULL;
+	spin_unlock_bh(&leo_shared_lock);
+	free_page((unsigned long)sp);
+}
+
+static void
+leo_edge_timer_start(void)
+{
+	const struct leo_schedule *ls;
+	u64 njiffies, timo;
+
+	rcu_read_lock();
+	ls = leo_schedule_get();
+	njiffies = leo_phase(ls);
+	/* the jitter avoids firing twice for the same edge. */
+	if (njiffies + LEO_HANDOVER_TIME_JITTER < ls->start)
+		timo = ls->start - njiffies;
+	else if (njiffies + LEO_HANDOVER_TIME_JITTER < ls->end)
+		timo = ls->end - njiffies;
+	else
+		timo = ls->start + ls->interval - njiffies;
+	rcu_read_unlock();
+
+	hrtimer_start(&leo_edge_timer, ns_to_ktime(timo / HZ),
+	    HRTIMER_MODE_REL_SOFT);
+}
+
+static void
+leo_genl_notify(u8 event)
+{
+	struct sk_buff *msg;
+	void *hdr;
+
+	if (! genl_has_listeners(&leo_genl_family, &init_net, 0))
+		return;
+
+	msg = genlmsg_new(NLMSG_GOODSIZE, GFP_ATOMIC);
+	if (msg == NULL)
+		return;
+	hdr = genlmsg_put(msg, 0, 0, &leo_genl_family, 0, LEO_CMD_EVENT);
+	if (hdr == NULL ||
+	    nla_put_u8(msg, LEO_ATTR_EVENT, event) ||
+	    nla_put_u64_64bit(msg, LEO_ATTR_TIME_NS, ktime_get_real_ns(),
+	    LEO_ATTR_PAD)) {
+		nlmsg_free(msg);
+		return;
+	}
+	genlmsg_end(msg, hdr);
+	genlmsg_multicast(&leo_genl_family, msg, 0, 0, GFP_ATOMIC);
+}
+
+static enum hrtimer_restart
+leo_edge(struct hrtimer *hrt)
+{
+	const struct leo_schedule *ls;
+	u64 njiffies;
+	u8 event;
+
+	rcu_read_lock();
+	ls = leo_schedule_get();
+	njiffies = leo_phase(ls) + LEO_HANDOVER_TIME_JITTER;
+	event = ls->start <= njiffies && njiffies < ls->end ?
+	    LEO_EVENT_START : LEO_EVENT_END;
+	rcu_read_unlock();
+
+	leo_genl_notify(event);
+	leo_shared_update();
+	leo_edge_timer_start();
+
+	return HRTIMER_NORESTART;
+}
+
+/* must be called with leo_schedule_lock held. */
+static int
+leo_schedule_replace(const struct leo_schedule *tmpl)
+{
+	struct leo_schedule *ls, *ols;
+	s64 offset_ms;
+
+	if (tmpl->interval_ms == 0 || MSEC_PER_MIN % tmpl->interval_ms != 0 ||
+	    tmpl->start_ms > LEO_HANDOVER_OFFSET_MAX ||
+	    tmpl->duration_ms > LEO_HANDOVER_OFFSET_MAX ||
+	    tmpl->start_ms > tmpl->time_ms ||
+	    tmpl->time_ms - tmpl->start_ms + tmpl->duration_ms >=
+	    tmpl->interval_ms)
+		return -EINVAL;
+
+	ls = kmalloc(sizeof(*ls), GFP_KERNEL);
+	if (ls == NULL)
+		return -ENOMEM;
+	*ls = *tmpl;
+	offset_ms = tmpl->offset_ms % (s64)tmpl->interval_ms;
+	if (offset_ms < 0)
+		offset_ms += tmpl->interval_ms;
+	ls->interval = MSEC_TO_LEO_JIFFIES(ls->interval_ms);
+	ls->time = MSEC_TO_LEO_JIFFIES(ls->time_ms);
+	ls->start = ls->time - MSEC_TO_LEO_JIFFIES(ls->start_ms);
+	ls->end = ls->start + MSEC_TO_LEO_JIFFIES(ls->duration_ms);
+	ls->offset = MSEC_TO_LEO_JIFFIES(offset_ms);
+
+	ols = rcu_replace_pointer(leo_schedule, ls,
+	    lockdep_is_held(&leo_schedule_lock));
+	if (ols != NULL)
+		kfree_rcu(ols, rcu);
+
+	DP("LEO: schedule: interval: %u, time: %u, start: %u, duration: %u, "
+	    "offset: %d\n", ls->interval_ms, ls->time_ms, ls->start_ms,
+	    ls->duration_ms, ls->offset_ms);
+
+	return 0;
+}
+
+/* must be called with leo_schedule_lock held. */
+static struct leo_schedule *
+leo_schedule_current(void)
+{
+
+	return rcu_dereference_protected(leo_schedule,
+	    lockdep_is_held(&leo_schedule_lock));
+}
+
+static void
+leo_schedule_changed(void)
+{
+
+	leo_kick();
+	leo_shared_update();
+	leo_edge_timer_start();
+}
+
+static int
+leo_param_set_ms(const char *val, const struct kernel_param *kp)
+{
+	struct leo_schedule tmpl, *ls;
+	unsigned int ms;
+	int error;
+
+	error = kstrtouint(val, 0, &ms);
+	if (error != 0)
+		return error;
+	ms = __LEO_HANDOVER_OFFSET(ms);
+
+	mutex_lock(&leo_schedule_lock);
+	/* the schedule is not yet built while loading the module. */
+	ls = leo_schedule_current();
+	if (ls != NULL) {
+		tmpl = *ls;
+		if (kp->arg == &leo_handover_start_ms)
+			tmpl.start_ms = ms;
+		else
+			tmpl.duration_ms = ms;
+		error = leo_schedule_replace(&tmpl);
+	}
+	if (error == 0)
+		*(unsigned int *)kp->arg = ms;
+	mutex_unlock(&leo_schedule_lock);
+
+	if (error == 0 && ls != NULL)
+		leo_schedule_changed();
+	return error;
+}
+
+static int
+leo_schedule_init(void)
+{
+	struct leo_schedule tmpl = {
+		.interval_ms	= LEO_HANDOVER_INTERVAL_MS,
+		.time_ms	= LEO_HANDOVER_TIME_MS,
+		.start_ms	= __LEO_HANDOVER_OFFSET(leo_handover_start_ms),
+		.duration_ms	= __LEO_HANDOVER_OFFSET(leo_handover_duration_ms),
+		.offset_ms	= 0,
+	};
+	int error;
+
+	mutex_lock(&leo_schedule_lock);
+	error = leo_schedule_replace(&tmpl);
+	mutex_unlock(&leo_schedule_lock);
+
+	return error;
+}
+
+static void
+leo_schedule_finish(void)
+{
+	struct leo_schedule *ls;
+
+	ls = rcu_replace_pointer(leo_schedule, NULL, true);
+	if (ls != NULL)
+		kfree_rcu(ls, rcu);
+}
+
+static int
+leo_genl_get(struct sk_buff *skb, struct genl_info *info)
+{
+	const struct leo_schedule *ls;
+	struct sk_buff *msg;
+	void *hdr;
+
+	msg = genlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+	if (msg == NULL)
+		return -ENOMEM;
+	hdr = genlmsg_put_reply(msg, info, &leo_genl_family, 0,
+	    LEO_CMD_GET_SCHEDULE);
+	if (hdr == NULL)
+		goto failure;
+
+	rcu_read_lock();
+	ls = leo_schedule_get();
+	if (nla_put_u32(msg, LEO_ATTR_INTERVAL_MS, ls->interval_ms) ||
+	    nla_put_u32(msg, LEO_ATTR_TIME_MS, ls->time_ms) ||
+	    nla_put_u32(msg, LEO_ATTR_START_MS, ls->start_ms) ||
+	    nla_put_u32(msg, LEO_ATTR_DURATION_MS, ls->duration_ms) ||
+	    nla_put_s32(msg, LEO_ATTR_OFFSET_MS, ls->offset_ms) ||
+	    nla_put_u8(msg, LEO_ATTR_OUTAGE, READ_ONCE(leo_outage))) {
+		rcu_read_unlock();
+		goto failure;
+	}
+	rcu_read_unlock();
+
+	genlmsg_end(msg, hdr);
+	return genlmsg_reply(msg, info);
+
+failure:
+	nlmsg_free(msg);
+	return -EMSGSIZE;
+}
+
+static int
+leo_genl_set(struct sk_buff *skb, struct genl_info *info)
+{
+	struct leo_schedule tmpl;
+	struct nlattr **attrs = info->attrs;
+	int error;
+
+	mutex_lock(&leo_schedule_lock);
+	tmpl = *leo_schedule_current();
+	if (attrs[LEO_ATTR_INTERVAL_MS] != NULL)
+		tmpl.interval_ms = nla_get_u32(attrs[LEO_ATTR_INTERVAL_MS]);
+	if (attrs[LEO_ATTR_TIME_MS] != NULL)
+		tmpl.time_ms = nla_get_u32(attrs[LEO_ATTR_TIME_MS]);
+	if (attrs[LEO_ATTR_START_MS] != NULL)
+		tmpl.start_ms = nla_get_u32(attrs[LEO_ATTR_START_MS]);
+	if (attrs[LEO_ATTR_DURATION_MS] != NULL)
+		tmpl.duration_ms = nla_get_u32(attrs[LEO_ATTR_DURATION_MS]);
+	if (attrs[LEO_ATTR_OFFSET_MS] != NULL)
+		tmpl.offset_ms = nla_get_s32(attrs[LEO_ATTR_OFFSET_MS]);
+	error = leo_schedule_replace(&tmpl);
+	if (error == 0) {
+		/* keep module parameters consistent. */
+		WRITE_ONCE(leo_handover_start_ms, tmpl.start_ms);
+		WRITE_ONCE(leo_handover_duration_ms, tmpl.duration_ms);
+	}
+	mutex_unlock(&leo_schedule_lock);
+
+	if (error != 0) {
+		GENL_SET_ERR_MSG(info, "invalid schedule");
+		return error;
+	}
+	leo_schedule_changed();
+	return 0;
+}
+
+static int
+leo_genl_outage(struct sk_buff *skb, struct genl_info *info)
+{
+	bool outage;
+
+	outage = info->genlhdr->cmd == LEO_CMD_OUTAGE_START;
+	DP("LEO: outage: %s\n", outage ? "start" : "end");
+	WRITE_ONCE(leo_outage, outage);
+	leo_kick();
+	leo_shared_update();
+	leo_genl_notify(outage ? LEO_EVENT_OUTAGE_START : LEO_EVENT_OUTAGE_END);
+
+	return 0;
+}
+
+/*
+ * turn on or off notifications of a socket given by its cookie.
+ * only the owner of the socket or an administrator can subscribe.
+ */
+static int
+leo_genl_subscribe(struct sk_buff *skb, struct genl_info *info)
+{
+	struct rhashtable_iter hti;
+	struct leo_sock *lsk;
+	struct leo *leo;
+	struct sock *sk;
+	u64 cookie;
+	bool notify;
+	int error;
+
+	if (info->attrs[LEO_ATTR_COOKIE] == NULL)
+		return -EINVAL;
+	cookie = nla_get_u64(info->attrs[LEO_ATTR_COOKIE]);
+	/* sockets never asked for their cookie still have 0. */
+	if (cookie == 0)
+		return -EINVAL;
+	notify = true;
+	if (info->attrs[LEO_ATTR_NOTIFY] != NULL)
+		notify = nla_get_u8(info->attrs[LEO_ATTR_NOTIFY]) != 0;
+
+	/*
+	 * the flag is kept in struct leo_sock so that it survives the
+	 * state freed while idle, or not yet allocated.  struct leo is
+	 * only written with the socket locked, and the timer copies the
+	 * flag there.
+	 */
+	error = -ENOENT;
+	rhashtable_walk_enter(&leo_sock_hash, &hti);
+	rhashtable_walk_start(&hti);
+	while ((lsk = rhashtable_walk_next(&hti)) != NULL) {
+		if (IS_ERR(lsk))
+			continue;
+		sk = lsk->sk;
+		if (atomic64_read(&sk->sk_cookie) != cookie)
+			continue;
+		if (! uid_eq(sk->sk_uid, current_fsuid()) &&
+		    ! netlink_capable(skb, CAP_NET_ADMIN)) {
+			error = -EPERM;
+			break;
+		}
+		DP("LEO[%p]: notify: %s\n", sk, notify ? "on" : "off");
+		WRITE_ONCE(lsk->notify, notify);
+		/* pairs with leo_activate(). */
+		smp_mb();
+		/* the timer copies the flag, and re-arms for the notice. */
+		leo = leo_lookup(sk);
+		if (leo != NULL)
+			mod_timer_pending(&leo->handover_timer, jiffies);
+		error = 0;
+		break;
+	}
+	rhashtable_walk_stop(&hti);
+	rhashtable_walk_exit(&hti);
+
+	return error;
+}
+
+static int
+leo_genl_route_parse(struct genl_info *info, struct leo_route *r)
+{
+	struct nlattr **attrs = info->attrs;
+	struct in6_addr addr;
+	u8 plen;
+
+	if (attrs[LEO_ATTR_ADDR] == NULL || attrs[LEO_ATTR_PREFIXLEN] == NULL)
+		return -EINVAL;
+	plen = nla_get_u8(attrs[LEO_ATTR_PREFIXLEN]);
+	switch (nla_len(attrs[LEO_ATTR_ADDR])) {
+	case sizeof(struct in_addr):
+		if (plen > 32)
+			return -EINVAL;
+		ipv6_addr_set_v4mapped(nla_get_in_addr(attrs[LEO_ATTR_ADDR]),
+		    &addr);
+		plen += 96;
+		break;
+	case sizeof(struct in6_addr):
+		if (plen > 128)
+			return -EINVAL;
+		addr = nla_get_in6_addr(attrs[LEO_ATTR_ADDR]);
+		break;
+	default:
+		return -EINVAL;
+	}
+	ipv6_addr_prefix(&r->prefix, &addr, plen);
+	r->plen = plen;
+
+	r->mode = LEO_ROUTE_ENABLE;
+	if (attrs[LEO_ATTR_MODE] != NULL)
+		r->mode = nla_get_u8(attrs[LEO_ATTR_MODE]);
+	if (r->mode >= ARRAY_SIZE(leo_route_mode_names))
+		return -EINVAL;
+	r->flags = 0;
+	r->start_ms = 0;
+	r->duration_ms = 0;
+	r->offset_ms = 0;
+	if (attrs[LEO_ATTR_START_MS] != NULL) {
+		r->start_ms = nla_get_u32(attrs[LEO_ATTR_START_MS]);
+		r->flags |= LEO_ROUTE_F_START;
+	}
+	if (attrs[LEO_ATTR_DURATION_MS] != NULL) {
+		r->duration_ms = nla_get_u32(attrs[LEO_ATTR_DURATION_MS]);
+		r->flags |= LEO_ROUTE_F_DURATION;
+	}
+	if (attrs[LEO_ATTR_OFFSET_MS] != NULL) {
+		r->offset_ms = nla_get_s32(attrs[LEO_ATTR_OFFSET_MS]);
+		r->flags |= LEO_ROUTE_F_OFFSET;
+	}
+	if (r->start_ms > LEO_HANDOVER_OFFSET_MAX ||
+	    r->duration_ms > LEO_HANDOVER_OFFSET_MAX)
+		return -EINVAL;
+	return 0;
+}
+
+/* sockets look up the route again at the next CA_EVENT_TX_START. */
+static void
+leo_route_changed(void)
+{
+
+	lockdep_assert_held(&leo_route_lock);
+	smp_wmb();
+	WRITE_ONCE(leo_route_gen, leo_route_gen + 1);
+}
+
+/* add or replace a route. */
+static int
+leo_genl_route_add(struct sk_buff *skb, struct genl_info *info)
+{
+	struct leo_route *nr, *r;
+	int error;
+
+	nr = kmalloc(sizeof(*nr), GFP_KERNEL);
+	if (nr == NULL)
+		return -ENOMEM;
+	error = leo_genl_route_parse(info, nr);
+	if (error != 0) {
+		GENL_SET_ERR_MSG(info, "invalid route");
+		kfree(nr);
+		return error;
+	}
+
+	mutex_lock(&leo_route_lock);
+	list_for_each_entry(r, &leo_routes, list) {
+		if (r->plen == nr->plen &&
+		    ipv6_addr_equal(&r->prefix, &nr->prefix)) {
+			list_replace_rcu(&r->list, &nr->list);
+			kfree_rcu(r, rcu);
+			goto out;
+		}
+		/* keep sorted by prefix length. */
+		if (r->plen < nr->plen)
+			break;
+	}
+	/* before r, or at the tail if none is shorter. */
+	list_add_tail_rcu(&nr->list, &r->list);
+out:
+	leo_route_changed();
+	DP("LEO: route: add: %pI6c/%u %s\n", &nr->prefix, nr->plen,
+	    leo_route_mode_names[nr->mode]);
+	mutex_unlock(&leo_route_lock);
+
+	return 0;
+}
+
+static int
+leo_genl_route_del(struct sk_buff *skb, struct genl_info *info)
+{
+	struct leo_route key, *r;
+	int error;
+
+	error = leo_genl_route_parse(info, &key);
+	if (error != 0) {
+		GENL_SET_ERR_MSG(info, "invalid route");
+		return error;
+	}
+
+	error = -ENOENT;
+	mutex_lock(&leo_route_lock);
+	list_for_each_entry(r, &leo_routes, list) {
+		if (r->plen == key.plen &&
+		    ipv6_addr_equal(&r->prefix, &key.prefix)) {
+			list_del_rcu(&r->list);
+			kfree_rcu(r, rcu);
+			leo_route_changed();
+			error = 0;
+			break;
+		}
+	}
+	mutex_unlock(&leo_route_lock);
+
+	return error;
+}
+
+static void
+leo_route_flush(void)
+{
+	struct leo_route *r, *nr;
+
+	mutex_lock(&leo_route_lock);
+	list_for_each_entry_safe(r, nr, &leo_routes, list) {
+		list_del_rcu(&r->list);
+		kfree_rcu(r, rcu);
+	}
+	leo_route_changed();
+	mutex_unlock(&leo_route_lock);
+}
+
+static int
+leo_genl_route_flush(struct sk_buff *skb, struct genl_info *info)
+{
+
+	leo_route_flush();
+	return 0;
+}
+
+static const struct nla_policy leo_genl_policy[LEO_ATTR_MAX + 1] = {
+	[LEO_ATTR_INTERVAL_MS]	= { .type = NLA_U32 },
+	[LEO_ATTR_TIME_MS]	= { .type = NLA_U32 },
+	[LEO_ATTR_START_MS]	= { .type = NLA_U32 },
+	[LEO_ATTR_DURATION_MS]	= { .type = NLA_U32 },
+	[LEO_ATTR_OFFSET_MS]	= { .type = NLA_S32 },
+	[LEO_ATTR_OUTAGE]	= { .type = NLA_U8 },
+	[LEO_ATTR_EVENT]	= { .type = NLA_U8 },
+	[LEO_ATTR_TIME_NS]	= { .type = NLA_U64 },
+	[LEO_ATTR_COOKIE]	= { .type = NLA_U64 },
+	[LEO_ATTR_NOTIFY]	= { .type = NLA_U8 },
+	[LEO_ATTR_ADDR]		= { .type = NLA_BINARY,
+				    .len = sizeof(struct in6_addr) },
+	[LEO_ATTR_PREFIXLEN]	= { .type = NLA_U8 },
+	[LEO_ATTR_MODE]		= { .type = NLA_U8 },
+};
+
+static const struct genl_small_ops leo_genl_ops[] = {
+	{
+		.cmd	= LEO_CMD_GET_SCHEDULE,
+		.doit	= leo_genl_get,
+	},
+	{
+		.cmd	= LEO_CMD_SET_SCHEDULE,
+		.doit	= leo_genl_set,
+		.flags	= GENL_ADMIN_PERM,
+	},
+	{
+		.cmd	= LEO_CMD_OUTAGE_START,
+		.doit	= leo_genl_outage,
+		.flags	= GENL_ADMIN_PERM,
+	},
+	{
+		.cmd	= LEO_CMD_OUTAGE_END,
+		.doit	= leo_genl_outage,
+		.flags	= GENL_ADMIN_PERM,
+	},
+	{
+		.cmd	= LEO_CMD_SUBSCRIBE,
+		.doit	= leo_genl_subscribe,
+	},
+	{
+		.cmd	= LEO_CMD_ROUTE_ADD,
+		.doit	= leo_genl_route_add,
+		.flags	= GENL_ADMIN_PERM,
+	},
+	{
+		.cmd	= LEO_CMD_ROUTE_DEL,
+		.doit	= leo_genl_route_del,
+		.flags	= GENL_ADMIN_PERM,
+	},
+	{
+		.cmd	= LEO_CMD_ROUTE_FLUSH,
+		.doit	= leo_genl_route_flush,
+		.flags	= GENL_ADMIN_PERM,
+	},
+};
+
+static const struct genl_multicast_group leo_genl_mcgrps[] = {
+	{ .name = LEO_GENL_MCGRP_EVENTS, },
+};
+
+static struct genl_family leo_genl_family = {
+	.name		= LEO_GENL_NAME,
+	.version	= LEO_GENL_VERSION,
+	.maxattr	= LEO_ATTR_MAX,
+	.policy		= leo_genl_policy,
+	.module		= THIS_MODULE,
+	.small_ops	= leo_genl_ops,
+	.n_small_ops	= ARRAY_SIZE(leo_genl_ops),
+	.mcgrps		= leo_genl_mcgrps,
+	.n_mcgrps	= ARRAY_SIZE(leo_genl_mcgrps),
+};
+
+static int
+leo_ctl_init(void)
+{
+	int error;
+
+	error = genl_register_family(&leo_genl_family);
+	if (error != 0)
+		return error;
+	error = leo_shared_init();
+	if (error != 0) {
+		genl_unregister_family(&leo_genl_family);
+		return error;
+	}
+
+	hrtimer_init(&leo_edge_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+	leo_edge_timer.function = leo_edge;
+	leo_edge_timer_start();
+
+	return 0;
+}
+
+static void
+leo_ctl_finish(void)
+{
+
+	/* no more commands may restart the edge timer. */
+	genl_unregister_family(&leo_genl_family);
+	(void)hrtimer_cancel(&leo_edge_timer);
+	leo_shared_finish();
+	leo_route_flush();
+}
+
+static struct dentry *
+leo_trace_create_buf_file(const char *filename, struct dentry *parent,
+    umode_t mode, struct rchan_buf *buf, int *is_global)
+{
+
+	return debugfs_create_file(filename, mode, parent, buf,
+	    &relay_file_operations);
+}
+
+static int
+leo_trace_remove_buf_file(struct dentry *dentry)
+{
+
+	debugfs_remove(dentry);
+	return 0;
+}
+
+static const struct rchan_callbacks leo_trace_callbacks = {
+	.create_buf_file	= leo_trace_create_buf_file,
+	.remove_buf_file	= leo_trace_remove_buf_file,
+};
+
+static void
+leo_trace_init(void)
+{
+
+	leo_debugfs_dir = debugfs_create_dir("tcp_leo", NULL);
+	if (leo_trace_subbuf_size == 0 || leo_trace_nsubbufs == 0)
+		return;
+	leo_trace_chan = relay_open("trace", leo_debugfs_dir,
+	    leo_trace_subbuf_size, leo_trace_nsubbufs,
+	    &leo_trace_callbacks, NULL);
+	if (leo_trace_chan == NULL)
+		printk(KERN_WARNING "LEO: cannot open trace buffers\n");
+}
+
+static void
+leo_trace_finish(void)
+{
+
+	if (leo_trace_chan != NULL)
+		relay_close(leo_trace_chan);
+	debugfs_remove_recursive(leo_debugfs_dir);
 }
 
 BTF_SET8_START(leo_check_kfunc_ids)
@@ -414,18 +3097,57 @@ leo_register(void)
 	if (ret < 0)
 		return ret;
 
+	ret = leo_schedule_init();
+	if (ret < 0)
+		return ret;
+	ret = leo_hash_init();
+	if (ret < 0)
+		goto schedule_failure;
+	ret = leo_proc_init();
+	if (ret < 0)
+		goto hash_failure;
+	ret = leo_hist_init();
+	if (ret < 0)
+		goto proc_failure;
+
+	leo_trace_init();
 	leo_time_init();
+	ret = leo_ctl_init();
+	if (ret < 0)
+		goto time_failure;
 	DP("LEO: time: %lld.%09lld\n",
 	    leo_time() / NSEC_PER_SEC, leo_time() % NSEC_PER_SEC);
 
 	return 0;
+
+time_failure:
+	leo_time_finish();
+	leo_trace_finish();
+	leo_proc_finish();
+	leo_hist_finish();
+	leo_hash_finish();
+	leo_schedule_finish();
+	return ret;
+proc_failure:
+	leo_proc_finish();
+hash_failure:
+	leo_hash_finish();
+schedule_failure:
+	leo_schedule_finish();
+	return ret;
 }
 
 static void __exit
 leo_unregister(void)
 {
 
+	leo_ctl_finish();
 	leo_time_finish();
+	leo_trace_finish();
+	leo_proc_finish();
+	leo_hist_finish();
+	leo_hash_finish();
+	leo_schedule_finish();
 }
 
 module_init(leo_register);
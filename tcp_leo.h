@@ -1,3 +1,7 @@
+#include <linux/rhashtable-types.h>
+
+#include "tcp_leo_uapi.h"
+
 #ifdef LEO_NODEBUG
 #define DP(...)
 #else /* LEO_NODEBUG */
@@ -17,7 +21,83 @@ struct leo {
 	struct timer_list handover_timer;
 	void *sock;
 	u32 *last_snd_cwnd;
+	struct hlist_node list;		/* all LEO sockets, see leo_list */
+	struct rhlist_head node;	/* lookup by socket, see leo_hash */
+	struct rcu_head rcu;
+	u32 nsuspend;			/* number of suspensions */
+	u32 nresume;			/* number of resumptions */
+	u32 last_delivered;		/* tp->delivered at the last ACK */
+	u32 last_lost;			/* tp->lost at the last ACK */
+	u64 bytes_acked;		/* tp->bytes_acked when initialized */
+	u32 total_retrans;		/* tp->total_retrans when initialized */
+	unsigned long start;		/* jiffies when initialized */
+	bool shadow;			/* only record, never touch cwnd */
+	bool suspended;			/* in a handover window */
+	bool released;			/* freed by the timer soon */
+	bool notify;			/* subscribed to notifications */
+	bool notified;			/* notified the coming window */
+	/* adjustments of the schedule by the route of the peer. */
+	unsigned int route_gen;		/* leo_route_gen when looked up */
+	u8 route_flags;
+	u32 route_start_ms;
+	u32 route_duration_ms;
+	s32 route_offset_ms;
+	/* snapshots at the beginning of the current window. */
+	u32 win_inflight;
+	u32 win_lost;
+	u32 win_retrans;
+	u32 win_rto;
+	u32 win_start;			/* jiffies */
+	unsigned long win_pacing_rate;
+	int win_sndbuf;			/* sk_sndbuf before expanded, or 0 */
+	int win_sndbuf_expanded;	/* sk_sndbuf expanded to */
+	/* undo of a reduction by handover, see leo_undo(). */
+	u8 undo_state;			/* enum leo_undo_state */
+	u32 undo_cwnd;
+	u32 undo_ssthresh;
+	u32 undo_delivered;		/* tp->delivered when checking */
+	u32 undo_lost;			/* tp->lost when checking */
+	u32 suspended_jiffies;		/* total of windows suspended */
+	/* windows ended, see leo_handover_seq(). */
+	u32 handover_seq;
+	u64 handover_seq_next;		/* tcp_clock_us() of the next end */
+	/* the first transmission after resumption, see leo_resume_mark(). */
+	u64 resume_ns;			/* scheduled end of the window, or 0 */
+	u32 resume_segs;		/* tp->data_segs_out at resumption */
+	u8 resume_cause;		/* enum leo_resume_cause */
+	u32 resume_cnt;
+	u32 resume_max_us;
+	u64 resume_sum_us;
+};
+
+/*
+ * passed to leo_policy(), i.e., a BPF program.  see enum
+ * leo_policy_point and enum leo_policy_verdict.
+ */
+struct leo_policy_ctx {
+	struct sock *sk;
+	u32 point;			/* enum leo_policy_point */
+	u32 phase_us;			/* time in the handover interval */
+	u32 interval_us;
+	u32 start_us;			/* window start in the interval */
+	u32 end_us;			/* window end in the interval */
+	u32 rtt_us;			/* latest RTT sample */
+	u32 srtt_us;
+	u32 min_rtt_us;
+	u32 nsuspend;
+	bool handover;			/* decision by the schedule */
+	bool suspended;			/* currently suspended */
+	bool outage;
 };
 
-bool leo_handover_check(struct sock *, u32);
-void leo_init(struct sock *, u32 *);
+bool leo_handover_check(struct sock *, u32 *);
+void leo_acked(struct sock *, s32);
+bool leo_rtt_guarded(struct sock *, s32);
+u32 leo_handover_seq(struct sock *);
+u32 leo_suspended_jiffies(struct sock *);
+void leo_ssthresh(struct sock *);
+bool leo_undo(struct sock *);
+void leo_cwnd_event(struct sock *, enum tcp_ca_event);
+bool leo_init(struct sock *, u32 *);
+void leo_reevaluate(struct sock *, u32 *);
+void leo_release(struct sock *);
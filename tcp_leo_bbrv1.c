@@ -104,7 +104,12 @@ struct bbr {
 		round_start:1,	     /* start of packet-timed tx->ack round? */
 		idle_restart:1,	     /* restarting after idle? */
 		probe_rtt_round_done:1,  /* a BBR_PROBE_RTT round at 4 pkts? */
+#ifdef TCP_LEO_BBR
+		leo:1,		     /* leo_init() succeeded? */
+		unused:12,
+#else /* TCP_LEO_BBR */
 		unused:13,
+#endif /* ! TCP_LEO_BBR */
 		lt_is_sampling:1,    /* taking long-term ("LT") samples now? */
 		lt_rtt_cnt:7,	     /* round trips in long-term interval */
 		lt_use_bw:1;	     /* use lt_bw as our bw estimate? */
@@ -338,6 +343,15 @@ __bpf_kfunc static void bbr_cwnd_event(struct sock *sk, enum tcp_ca_event event)
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct bbr *bbr = inet_csk_ca(sk);
 
+#ifdef TCP_LEO_BBR
+	/* the route may have changed after idle or RTO. */
+	if (bbr->leo) {
+		if (event == CA_EVENT_TX_START || event == CA_EVENT_LOSS)
+			leo_reevaluate(sk, &bbr->prior_cwnd);
+		leo_cwnd_event(sk, event);
+	}
+#endif /* TCP_LEO_BBR */
+
 	if (event == CA_EVENT_TX_START && tp->app_limited) {
 		bbr->idle_restart = 1;
 		bbr->ack_epoch_mstamp = tp->tcp_mstamp;
@@ -1034,8 +1048,11 @@ __bpf_kfunc static void bbr_main(struct sock *sk, const struct rate_sample *rs)
 	u32 bw;
 
 #ifdef TCP_LEO_BBR
-	if (leo_handover_check(sk, bbr->prior_cwnd))
-		return;
+	if (bbr->leo) {
+		leo_acked(sk, rs->rtt_us);
+		if (leo_handover_check(sk, &bbr->prior_cwnd))
+			return;
+	}
 #endif /* TCP_LEO_BBR */
 
 	bbr_update_model(sk, rs);
@@ -1086,10 +1103,20 @@ __bpf_kfunc static void bbr_init(struct sock *sk)
 
 	cmpxchg(&sk->sk_pacing_status, SK_PACING_NONE, SK_PACING_NEEDED);
 #ifdef TCP_LEO_BBR
-	leo_init(sk, &bbr->prior_cwnd);
+	bbr->leo = leo_init(sk, &bbr->prior_cwnd);
 #endif /* TCP_LEO_BBR */
 }
 
+#ifdef TCP_LEO_BBR
+static void bbr_release(struct sock *sk)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	if (bbr->leo)
+		leo_release(sk);
+}
+#endif /* TCP_LEO_BBR */
+
 __bpf_kfunc static u32 bbr_sndbuf_expand(struct sock *sk)
 {
 	/* Provision 3 * cwnd since BBR may slow-start even during recovery. */
@@ -1161,6 +1188,9 @@ static struct tcp_congestion_ops tcp_bbr_cong_ops __read_mostly = {
 #endif /* ! TCP_LEO_BBR */
 	.owner		= THIS_MODULE,
 	.init		= bbr_init,
+#ifdef TCP_LEO_BBR
+	.release	= bbr_release,
+#endif /* TCP_LEO_BBR */
 	.cong_control	= bbr_main,
 	.sndbuf_expand	= bbr_sndbuf_expand,
 	.undo_cwnd	= bbr_undo_cwnd,
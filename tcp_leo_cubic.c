@@ -65,6 +65,121 @@ static u32 cube_rtt_scale __read_mostly;
 static u32 beta_scale __read_mostly;
 static u64 cube_factor __read_mostly;
 
+#ifdef TCP_LEO_CUBIC
+/*
+ * scale c/rtt by the min RTT of a flow instead of the constant Srtt
+ * (100ms) so that cwnd refills the pipe within a handover interval
+ * on short RTT paths.  the RTT is bounded to [rtt_scaling_min_us,
+ * RTT_SCALING_MAX_US] to never grow slower than the original nor
+ * overflow, and is refreshed every rtt_scaling_period_ms as it
+ * shifts at handovers.  rtt_scaling_min_us below
+ * RTT_SCALING_MIN_US_FLOOR is rejected as cwnd would grow too
+ * aggressively, and so is rtt_scaling_period_ms out of
+ * [RTT_SCALING_PERIOD_MS_MIN, RTT_SCALING_PERIOD_MS_MAX].
+ */
+#define RTT_SCALING_MIN_US_FLOOR	(5 * USEC_PER_MSEC)
+#define RTT_SCALING_MAX_US	(100 * USEC_PER_MSEC)	/* constant Srtt */
+#define RTT_SCALING_PERIOD_MS_MIN	(RTT_SCALING_MAX_US / USEC_PER_MSEC)
+#define RTT_SCALING_PERIOD_MS_MAX	(600 * MSEC_PER_SEC)
+static int rtt_scaling __read_mostly;
+static int rtt_scaling_min_us __read_mostly = 10000;
+static int rtt_scaling_period_ms __read_mostly = 15000;
+
+/* for module_param_cb() of ints in [min, max]. */
+static int cubictcp_param_set_range(const char *val,
+				    const struct kernel_param *kp,
+				    int min, int max)
+{
+	int n, ret;
+
+	ret = kstrtoint(val, 0, &n);
+	if (ret)
+		return ret;
+	if (n < min || n > max)
+		return -EINVAL;
+	return param_set_int(val, kp);
+}
+
+static int rtt_scaling_min_us_set(const char *val,
+				  const struct kernel_param *kp)
+{
+	return cubictcp_param_set_range(val, kp, RTT_SCALING_MIN_US_FLOOR,
+					RTT_SCALING_MAX_US);
+}
+
+static const struct kernel_param_ops rtt_scaling_min_us_ops = {
+	.set	= rtt_scaling_min_us_set,
+	.get	= param_get_int,
+};
+
+static int rtt_scaling_period_ms_set(const char *val,
+				     const struct kernel_param *kp)
+{
+	return cubictcp_param_set_range(val, kp, RTT_SCALING_PERIOD_MS_MIN,
+					RTT_SCALING_PERIOD_MS_MAX);
+}
+
+static const struct kernel_param_ops rtt_scaling_period_ms_ops = {
+	.set	= rtt_scaling_period_ms_set,
+	.get	= param_get_int,
+};
+
+/*
+ * HyStart++ (RFC 9406) instead of the detection by hystart_detect.
+ * an RTT increase over a round moves into Conservative Slow Start
+ * (CSS) growing by 1/hystart_css_growth_div, which goes back to slow
+ * start if RTT decreases, and ends after hystart_css_rounds rounds.
+ * the thresholds are bounded by HYSTART_RTT_THRESH_MAX_US, and the
+ * rounds and the divisor by U8_MAX as css_rounds is a u8.
+ */
+#define HYSTART_RTT_THRESH_MAX_US	USEC_PER_SEC
+static int hystart_plus __read_mostly;
+static int hystart_rtt_thresh_min_us __read_mostly = HYSTART_DELAY_MIN;
+static int hystart_rtt_thresh_max_us __read_mostly = HYSTART_DELAY_MAX;
+static int hystart_css_rounds __read_mostly = 5;
+static int hystart_css_growth_div __read_mostly = 4;
+
+static int hystart_rtt_thresh_us_set(const char *val,
+				     const struct kernel_param *kp)
+{
+	return cubictcp_param_set_range(val, kp, 1,
+					HYSTART_RTT_THRESH_MAX_US);
+}
+
+static const struct kernel_param_ops hystart_rtt_thresh_us_ops = {
+	.set	= hystart_rtt_thresh_us_set,
+	.get	= param_get_int,
+};
+
+static int hystart_css_set(const char *val, const struct kernel_param *kp)
+{
+	return cubictcp_param_set_range(val, kp, 1, U8_MAX);
+}
+
+static const struct kernel_param_ops hystart_css_ops = {
+	.set	= hystart_css_set,
+	.get	= param_get_int,
+};
+
+/*
+ * pace instead of ACK-clocked bursts.  the rate is computed by TCP
+ * as tcp_pacing_ss_ratio or tcp_pacing_ca_ratio (200% and 120% by
+ * default) of cwnd/srtt, and used by fq if any, or by the internal
+ * pacing otherwise.
+ */
+static int pacing __read_mostly;
+
+/*
+ * each handover is a new capacity epoch.  the delivery rate over the
+ * first BICTCP_REANCHOR_RTTS RTTs after a window gives the BDP of the
+ * new beam, and w_max is re-anchored to it: to cwnd if the pipe is
+ * not full so that CUBIC probes from there, or down to the BDP with
+ * cwnd reduced by at most beta if a queue is building.
+ */
+#define BICTCP_REANCHOR_RTTS	2
+static int wmax_reanchor __read_mostly;
+#endif /* TCP_LEO_CUBIC */
+
 /* Note parameters that are used for precomputing scale factors are read-only */
 module_param(fast_convergence, int, 0644);
 MODULE_PARM_DESC(fast_convergence, "turn on/off fast convergence");
@@ -85,6 +200,34 @@ module_param(hystart_low_window, int, 0644);
 MODULE_PARM_DESC(hystart_low_window, "lower bound cwnd for hybrid slow start");
 module_param(hystart_ack_delta_us, int, 0644);
 MODULE_PARM_DESC(hystart_ack_delta_us, "spacing between ack's indicating train (usecs)");
+#ifdef TCP_LEO_CUBIC
+module_param(rtt_scaling, int, 0644);
+MODULE_PARM_DESC(rtt_scaling, "turn on/off scaling cubic growth by min RTT");
+module_param_cb(rtt_scaling_min_us, &rtt_scaling_min_us_ops,
+		&rtt_scaling_min_us, 0644);
+MODULE_PARM_DESC(rtt_scaling_min_us, "lower bound of RTT for scaling (5000<=usecs<=100000)");
+module_param_cb(rtt_scaling_period_ms, &rtt_scaling_period_ms_ops,
+		&rtt_scaling_period_ms, 0644);
+MODULE_PARM_DESC(rtt_scaling_period_ms, "period to rescale by min RTT (100<=msecs<=600000)");
+module_param(hystart_plus, int, 0644);
+MODULE_PARM_DESC(hystart_plus, "turn on/off HyStart++ instead of hystart_detect");
+module_param_cb(hystart_rtt_thresh_min_us, &hystart_rtt_thresh_us_ops,
+		&hystart_rtt_thresh_min_us, 0644);
+MODULE_PARM_DESC(hystart_rtt_thresh_min_us, "lower bound of RTT increase to enter CSS (1<=usecs<=1000000)");
+module_param_cb(hystart_rtt_thresh_max_us, &hystart_rtt_thresh_us_ops,
+		&hystart_rtt_thresh_max_us, 0644);
+MODULE_PARM_DESC(hystart_rtt_thresh_max_us, "upper bound of RTT increase to enter CSS (1<=usecs<=1000000)");
+module_param_cb(hystart_css_rounds, &hystart_css_ops,
+		&hystart_css_rounds, 0644);
+MODULE_PARM_DESC(hystart_css_rounds, "rounds in CSS before congestion avoidance (1<=rounds<=255)");
+module_param_cb(hystart_css_growth_div, &hystart_css_ops,
+		&hystart_css_growth_div, 0644);
+MODULE_PARM_DESC(hystart_css_growth_div, "divisor of cwnd growth in CSS (1<=div<=255)");
+module_param(pacing, int, 0644);
+MODULE_PARM_DESC(pacing, "turn on/off pacing of new sockets");
+module_param(wmax_reanchor, int, 0644);
+MODULE_PARM_DESC(wmax_reanchor, "turn on/off re-anchoring w_max after handovers");
+#endif /* TCP_LEO_CUBIC */
 
 /* BIC TCP Parameters */
 struct bictcp {
@@ -99,19 +242,42 @@ struct bictcp {
 	u32	epoch_start;	/* beginning of an epoch */
 	u32	ack_cnt;	/* number of acks */
 	u32	tcp_cwnd;	/* estimated tcp cwnd */
+#ifdef TCP_LEO_CUBIC
+	u32	rtt_scale;	/* cube_rtt_scale by min RTT, or 0 */
+	u32	rtt_scale_stamp;/* time when rtt_scale is computed */
+	u32	delay_min_seq;	/* handover epoch of delay_min */
+	u32	leo_suspended;	/* leo_suspended_jiffies() last seen */
+	u32	reanchor_delivered;/* tp->delivered at reanchor_stamp */
+	u32	reanchor_stamp;	/* usec re-anchoring started, or 0 */
+	u8	unused;
+	u8	leo;		/* leo_init() succeeded? survives bictcp_reset() */
+#else /* TCP_LEO_CUBIC */
 	u16	unused;
+#endif /* ! TCP_LEO_CUBIC */
 	u8	sample_cnt;	/* number of samples to decide curr_rtt */
 	u8	found;		/* the exit point is found? */
 	u32	round_start;	/* beginning of each round */
 	u32	end_seq;	/* end_seq of the round */
 	u32	last_ack;	/* last time when the ACK spacing is close */
 	u32	curr_rtt;	/* the minimum rtt of current round */
+#ifdef TCP_LEO_CUBIC
+	u32	last_rtt;	/* the minimum rtt of last round, or 0 */
+	u32	css_baseline;	/* curr_rtt entering CSS, or 0 if not in CSS */
+	u8	css_rounds;	/* rounds in CSS */
+	u8	css_acked;	/* packets acked but not yet grown in CSS */
+#endif /* TCP_LEO_CUBIC */
 };
 
 static inline void bictcp_reset(struct bictcp *ca)
 {
 	memset(ca, 0, offsetof(struct bictcp, unused));
 	ca->found = 0;
+#ifdef TCP_LEO_CUBIC
+	ca->last_rtt = 0;
+	ca->css_baseline = 0;
+	ca->css_rounds = 0;
+	ca->css_acked = 0;
+#endif /* TCP_LEO_CUBIC */
 }
 
 static inline u32 bictcp_clock_us(const struct sock *sk)
@@ -143,14 +309,35 @@ __bpf_kfunc static void cubictcp_init(struct sock *sk)
 		tcp_sk(sk)->snd_ssthresh = initial_ssthresh;
 
 #ifdef TCP_LEO_CUBIC
-	leo_init(sk, &ca->last_cwnd);
+	if (pacing)
+		cmpxchg(&sk->sk_pacing_status, SK_PACING_NONE, SK_PACING_NEEDED);
+	ca->leo = leo_init(sk, &ca->last_cwnd);
 #endif /* TCP_LEO_CUBIC */
 }
 
+#ifdef TCP_LEO_CUBIC
+static void cubictcp_release(struct sock *sk)
+{
+	struct bictcp *ca = inet_csk_ca(sk);
+
+	if (ca->leo)
+		leo_release(sk);
+}
+#endif /* TCP_LEO_CUBIC */
+
 __bpf_kfunc static void cubictcp_cwnd_event(struct sock *sk, enum tcp_ca_event event)
 {
 	struct bictcp *ca = inet_csk_ca(sk);
 
+#ifdef TCP_LEO_CUBIC
+	/* the route may have changed after idle or RTO. */
+	if (ca->leo) {
+		if (event == CA_EVENT_TX_START || event == CA_EVENT_LOSS)
+			leo_reevaluate(sk, &ca->last_cwnd);
+		leo_cwnd_event(sk, event);
+	}
+#endif /* TCP_LEO_CUBIC */
+
 	if (event == CA_EVENT_LOSS) {
 		struct tcp_sock *tp = tcp_sk(sk);
 
@@ -174,10 +361,40 @@ __bpf_kfunc static void cubictcp_cwnd_event(struct sock *sk, enum tcp_ca_event e
 			if (after(ca->epoch_start, now))
 				ca->epoch_start = now;
 		}
+#ifdef TCP_LEO_CUBIC
+		/* the idle above covers suspension in it. */
+		if (ca->leo)
+			ca->leo_suspended = leo_suspended_jiffies(sk);
+#endif /* TCP_LEO_CUBIC */
 		return;
 	}
 }
 
+#ifdef TCP_LEO_CUBIC
+/*
+ * LEO suspension is idle as well.  shift epoch_start by the time
+ * suspended so that growth continues where it stopped instead of
+ * jumping along the curve after resumption.
+ */
+static void bictcp_leo_shift_epoch(struct sock *sk)
+{
+	struct bictcp *ca = inet_csk_ca(sk);
+	u32 now = tcp_jiffies32;
+	u32 suspended;
+	s32 delta;
+
+	suspended = leo_suspended_jiffies(sk);
+	/* the total starts over if the state is freed in idle. */
+	delta = suspended - ca->leo_suspended;
+	ca->leo_suspended = suspended;
+	if (ca->epoch_start && delta > 0) {
+		ca->epoch_start += delta;
+		if (after(ca->epoch_start, now))
+			ca->epoch_start = now;
+	}
+}
+#endif /* TCP_LEO_CUBIC */
+
 /* calculate the cubic root of x using a table lookup followed by one
  * Newton-Raphson iteration.
  * Avg err ~= 0.195%
@@ -226,6 +443,48 @@ static u32 cubic_root(u64 a)
 	return x;
 }
 
+#ifdef TCP_LEO_CUBIC
+static void bictcp_rtt_scale_update(struct bictcp *ca)
+{
+	u32 rtt_us;
+
+	ca->rtt_scale_stamp = tcp_jiffies32;
+	if (ca->delay_min == 0) {
+		ca->rtt_scale = 0;
+		return;
+	}
+	rtt_us = clamp_t(u32, ca->delay_min, READ_ONCE(rtt_scaling_min_us),
+			 RTT_SCALING_MAX_US);
+	ca->rtt_scale = div_u64((u64)cube_rtt_scale * RTT_SCALING_MAX_US,
+				rtt_us);
+}
+#endif /* TCP_LEO_CUBIC */
+
+static inline u32 bictcp_cube_rtt_scale(const struct bictcp *ca)
+{
+#ifdef TCP_LEO_CUBIC
+	if (rtt_scaling && ca->rtt_scale)
+		return ca->rtt_scale;
+#endif /* TCP_LEO_CUBIC */
+	return cube_rtt_scale;
+}
+
+static inline u64 bictcp_cube_factor(const struct bictcp *ca)
+{
+#ifdef TCP_LEO_CUBIC
+	/* once per epoch. */
+	if (rtt_scaling && ca->rtt_scale)
+		return div_u64(1ull << (10+3*BICTCP_HZ), ca->rtt_scale);
+#endif /* TCP_LEO_CUBIC */
+	return cube_factor;
+}
+
+#ifdef TCP_LEO_CUBIC_BENCH
+static bool bictcp_bench_loop;	/* run the original friendliness loop */
+#else /* TCP_LEO_CUBIC_BENCH */
+#define bictcp_bench_loop	false
+#endif /* ! TCP_LEO_CUBIC_BENCH */
+
 /*
  * Compute congestion window to use.
  */
@@ -250,6 +509,20 @@ static inline void bictcp_update(struct bictcp *ca, u32 cwnd, u32 acked)
 	ca->last_cwnd = cwnd;
 	ca->last_time = tcp_jiffies32;
 
+#ifdef TCP_LEO_CUBIC
+	/* a new scale re-anchors K at the current cwnd. */
+	if (rtt_scaling &&
+	    (ca->epoch_start == 0 ||
+	     (s32)(tcp_jiffies32 - ca->rtt_scale_stamp) >=
+	     (s32)msecs_to_jiffies(rtt_scaling_period_ms))) {
+		u32 scale = ca->rtt_scale;
+
+		bictcp_rtt_scale_update(ca);
+		if (ca->rtt_scale != scale)
+			ca->epoch_start = 0;
+	}
+#endif /* TCP_LEO_CUBIC */
+
 	if (ca->epoch_start == 0) {
 		ca->epoch_start = tcp_jiffies32;	/* record beginning */
 		ca->ack_cnt = acked;			/* start counting */
@@ -262,7 +535,7 @@ static inline void bictcp_update(struct bictcp *ca, u32 cwnd, u32 acked)
 			/* Compute new K based on
 			 * (wmax-cwnd) * (srtt>>3 / HZ) / c * 2^(3*bictcp_HZ)
 			 */
-			ca->bic_K = cubic_root(cube_factor
+			ca->bic_K = cubic_root(bictcp_cube_factor(ca)
 					       * (ca->last_max_cwnd - cwnd));
 			ca->bic_origin_point = ca->last_max_cwnd;
 		}
@@ -294,7 +567,7 @@ static inline void bictcp_update(struct bictcp *ca, u32 cwnd, u32 acked)
 		offs = t - ca->bic_K;
 
 	/* c/rtt * (t-K)^3 */
-	delta = (cube_rtt_scale * offs * offs * offs) >> (10+3*BICTCP_HZ);
+	delta = (bictcp_cube_rtt_scale(ca) * offs * offs * offs) >> (10+3*BICTCP_HZ);
 	if (t < ca->bic_K)                            /* below origin*/
 		bic_target = ca->bic_origin_point - delta;
 	else                                          /* above origin*/
@@ -320,10 +593,26 @@ tcp_friendliness:
 		u32 scale = beta_scale;
 
 		delta = (cwnd * scale) >> 3;
+#ifdef TCP_LEO_CUBIC
+		if (unlikely(bictcp_bench_loop)) {
+			/* the original loop to compare. */
+			while (delta != 0 && ca->ack_cnt > delta) {
+				ca->ack_cnt -= delta;
+				ca->tcp_cwnd++;
+			}
+		} else if (delta != 0 && ca->ack_cnt > delta) {
+			/* closed form of the loop below, leaving (0, delta]. */
+			u32 n = (ca->ack_cnt - 1) / delta;
+
+			ca->ack_cnt -= n * delta;
+			ca->tcp_cwnd += n;
+		}
+#else /* TCP_LEO_CUBIC */
 		while (ca->ack_cnt > delta) {		/* update tcp cwnd */
 			ca->ack_cnt -= delta;
 			ca->tcp_cwnd++;
 		}
+#endif /* ! TCP_LEO_CUBIC */
 
 		if (ca->tcp_cwnd > cwnd) {	/* if bic is slower than tcp */
 			delta = ca->tcp_cwnd - cwnd;
@@ -339,20 +628,55 @@ tcp_friendliness:
 	ca->cnt = max(ca->cnt, 2U);
 }
 
+#ifdef TCP_LEO_CUBIC
+static inline bool hystart_in_css(const struct bictcp *ca)
+{
+	return hystart_plus && !ca->found && ca->css_baseline;
+}
+
+/* slow start growing by 1/hystart_css_growth_div. */
+static u32 hystart_css_slow_start(struct tcp_sock *tp, struct bictcp *ca,
+				  u32 acked)
+{
+	u32 div = hystart_css_growth_div;
+	u32 n;
+
+	acked += ca->css_acked;
+	n = acked / div;
+	ca->css_acked = acked - n * div;
+	return tcp_slow_start(tp, n) * div;
+}
+#endif /* TCP_LEO_CUBIC */
+
 __bpf_kfunc static void cubictcp_cong_avoid(struct sock *sk, u32 ack, u32 acked)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct bictcp *ca = inet_csk_ca(sk);
 
+#ifdef TCP_LEO_CUBIC
+	/* app-limited flows must be suspended as well. */
+	if (ca->leo) {
+		if (leo_handover_check(sk, &ca->last_cwnd))
+			return;
+		bictcp_leo_shift_epoch(sk);
+		/* a reduction by handover is restored on the plateau. */
+		if (leo_undo(sk)) {
+			ca->epoch_start = 0;
+			ca->last_max_cwnd = max(ca->last_max_cwnd,
+						tcp_snd_cwnd(tp));
+		}
+	}
+#endif /* TCP_LEO_CUBIC */
+
 	if (!tcp_is_cwnd_limited(sk))
 		return;
 
+	if (tcp_in_slow_start(tp)) {
 #ifdef TCP_LEO_CUBIC
-	if (leo_handover_check(sk, ca->last_cwnd))
-		return;
+		if (hystart_in_css(ca))
+			acked = hystart_css_slow_start(tp, ca, acked);
+		else
 #endif /* TCP_LEO_CUBIC */
-
-	if (tcp_in_slow_start(tp)) {
 		acked = tcp_slow_start(tp, acked);
 		if (!acked)
 			return;
@@ -366,7 +690,19 @@ __bpf_kfunc static u32 cubictcp_recalc_ssthresh(struct sock *sk)
 	const struct tcp_sock *tp = tcp_sk(sk);
 	struct bictcp *ca = inet_csk_ca(sk);
 
+#ifdef TCP_LEO_CUBIC
+	if (ca->leo)
+		leo_ssthresh(sk);
+#endif /* TCP_LEO_CUBIC */
+
 	ca->epoch_start = 0;	/* end of epoch */
+#ifdef TCP_LEO_CUBIC
+	/* HyStart++ ends on a loss as well. */
+	if (hystart_plus) {
+		ca->found = 1;
+		ca->css_baseline = 0;
+	}
+#endif /* TCP_LEO_CUBIC */
 
 	/* Wmax and fast convergence */
 	if (tcp_snd_cwnd(tp) < ca->last_max_cwnd && fast_convergence)
@@ -468,16 +804,123 @@ static void hystart_update(struct sock *sk, u32 delay)
 	}
 }
 
+#ifdef TCP_LEO_CUBIC
+static void hystart_plus_update(struct sock *sk, u32 delay)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bictcp *ca = inet_csk_ca(sk);
+	u32 threshold;
+
+	if (after(tp->snd_una, ca->end_seq)) {
+		if (ca->css_baseline) {
+			if (ca->curr_rtt < ca->css_baseline) {
+				/* spurious, and back to slow start. */
+				ca->css_baseline = 0;
+				ca->css_rounds = 0;
+			} else if (++ca->css_rounds >= hystart_css_rounds) {
+				ca->found = 1;
+				NET_INC_STATS(sock_net(sk),
+					      LINUX_MIB_TCPHYSTARTDELAYDETECT);
+				NET_ADD_STATS(sock_net(sk),
+					      LINUX_MIB_TCPHYSTARTDELAYCWND,
+					      tcp_snd_cwnd(tp));
+				tp->snd_ssthresh = tcp_snd_cwnd(tp);
+				return;
+			}
+		}
+		ca->last_rtt = ca->curr_rtt != ~0U ? ca->curr_rtt : 0;
+		bictcp_hystart_reset(sk);
+	}
+
+	if (ca->curr_rtt > delay)
+		ca->curr_rtt = delay;
+	if (ca->sample_cnt < HYSTART_MIN_SAMPLES) {
+		ca->sample_cnt++;
+		return;
+	}
+	if (ca->css_baseline || !ca->last_rtt)
+		return;
+
+	threshold = clamp_t(u32, ca->last_rtt >> 3, hystart_rtt_thresh_min_us,
+			    max(hystart_rtt_thresh_min_us,
+				hystart_rtt_thresh_max_us));
+	if (ca->curr_rtt >= ca->last_rtt + threshold) {
+		pr_debug("hystart++ css (%u >= %u + %u) cwnd %u\n",
+			 ca->curr_rtt, ca->last_rtt, threshold,
+			 tcp_snd_cwnd(tp));
+		ca->css_baseline = ca->curr_rtt;
+		ca->css_rounds = 0;
+	}
+}
+#endif /* TCP_LEO_CUBIC */
+
+#ifdef TCP_LEO_CUBIC
+static void bictcp_reanchor_start(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	struct bictcp *ca = inet_csk_ca(sk);
+
+	ca->reanchor_delivered = tp->delivered;
+	ca->reanchor_stamp = max_t(u32, tp->tcp_mstamp, 1);
+}
+
+static void bictcp_reanchor_update(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bictcp *ca = inet_csk_ca(sk);
+	u32 elapsed, cwnd, bdp;
+
+	elapsed = (u32)tp->tcp_mstamp - ca->reanchor_stamp;
+	if (elapsed < BICTCP_REANCHOR_RTTS * ca->delay_min)
+		return;
+	ca->reanchor_stamp = 0;
+
+	/* the delivery rate tells nothing without a full cwnd. */
+	cwnd = tcp_snd_cwnd(tp);
+	if (ca->last_max_cwnd == 0 || tcp_in_slow_start(tp) ||
+	    inet_csk(sk)->icsk_ca_state != TCP_CA_Open ||
+	    !tcp_is_cwnd_limited(sk) || elapsed == 0)
+		return;
+
+	bdp = div_u64((u64)(tp->delivered - ca->reanchor_delivered) *
+		      ca->delay_min, elapsed);
+	if (bdp * 8 >= cwnd * 7) {
+		/* no queue, and the capacity is cwnd or more. */
+		ca->last_max_cwnd = cwnd;
+	} else {
+		ca->last_max_cwnd = max(bdp, 2U);
+		tcp_snd_cwnd_set(tp, max3(bdp, cwnd * beta / BICTCP_BETA_SCALE,
+					  2U));
+		/* not to slow start back over the queue. */
+		tp->snd_ssthresh = tcp_snd_cwnd(tp);
+	}
+	ca->epoch_start = 0;
+	pr_debug("wmax reanchor: cwnd %u bdp %u wmax %u\n",
+		 cwnd, bdp, ca->last_max_cwnd);
+}
+#endif /* TCP_LEO_CUBIC */
+
 __bpf_kfunc static void cubictcp_acked(struct sock *sk, const struct ack_sample *sample)
 {
 	const struct tcp_sock *tp = tcp_sk(sk);
 	struct bictcp *ca = inet_csk_ca(sk);
 	u32 delay;
 
+#ifdef TCP_LEO_CUBIC
+	if (ca->leo)
+		leo_acked(sk, sample->rtt_us);
+#endif /* TCP_LEO_CUBIC */
+
 	/* Some calls are for duplicates without timetamps */
 	if (sample->rtt_us < 0)
 		return;
 
+#ifdef TCP_LEO_CUBIC
+	/* inflated by reconfiguration around a handover window */
+	if (ca->leo && leo_rtt_guarded(sk, sample->rtt_us))
+		return;
+#endif /* TCP_LEO_CUBIC */
+
 	/* Discard delay samples right after fast recovery */
 	if (ca->epoch_start && (s32)(tcp_jiffies32 - ca->epoch_start) < HZ)
 		return;
@@ -486,19 +929,52 @@ __bpf_kfunc static void cubictcp_acked(struct sock *sk, const struct ack_sample
 	if (delay == 0)
 		delay = 1;
 
+#ifdef TCP_LEO_CUBIC
+	/*
+	 * a path via another satellite may be longer.  delay_min is
+	 * the min in the current handover epoch, and the last one is
+	 * kept until the first sample in a new epoch.
+	 */
+	if (ca->leo) {
+		u32 seq = leo_handover_seq(sk);
+
+		if (ca->delay_min_seq != seq) {
+			ca->delay_min_seq = seq;
+			ca->delay_min = delay;
+			if (wmax_reanchor)
+				bictcp_reanchor_start(sk);
+		}
+	}
+#endif /* TCP_LEO_CUBIC */
+
 	/* first time call or link delay decreases */
 	if (ca->delay_min == 0 || ca->delay_min > delay)
 		ca->delay_min = delay;
 
+#ifdef TCP_LEO_CUBIC
+	if (ca->reanchor_stamp)
+		bictcp_reanchor_update(sk);
+#endif /* TCP_LEO_CUBIC */
+
 	/* hystart triggers when cwnd is larger than some threshold */
 	if (!ca->found && tcp_in_slow_start(tp) && hystart &&
-	    tcp_snd_cwnd(tp) >= hystart_low_window)
+	    tcp_snd_cwnd(tp) >= hystart_low_window) {
+#ifdef TCP_LEO_CUBIC
+		if (hystart_plus) {
+			hystart_plus_update(sk, delay);
+			return;
+		}
+#endif /* TCP_LEO_CUBIC */
 		hystart_update(sk, delay);
+	}
 }
 
 static struct tcp_congestion_ops cubictcp __read_mostly = {
 	.flags		= TCP_CONG_NON_RESTRICTED,
 	.init		= cubictcp_init,
+#ifdef TCP_LEO_CUBIC
+	.release	= cubictcp_release,
+#endif /* TCP_LEO_CUBIC */
 	.ssthresh	= cubictcp_recalc_ssthresh,
 	.cong_avoid	= cubictcp_cong_avoid,
 	.set_state	= cubictcp_state,
@@ -527,6 +1003,65 @@ static const struct btf_kfunc_id_set tcp_cubic_kfunc_set = {
 	.set   = &tcp_cubic_check_kfunc_ids,
 };
 
+#ifdef TCP_LEO_CUBIC_BENCH
+/*
+ * microbenchmark of bictcp_update() reporting ns per ACK across
+ * cwnd, for the original TCP-friendliness loop and its closed form,
+ * run on loading a module built with -DTCP_LEO_CUBIC_BENCH.  every
+ * ACK comes a jiffy after the last one so that the cubic function is
+ * computed every time, and an epoch restarts every BICTCP_BENCH_EPOCH
+ * ACKs as on handovers.  ACKs ack 64 packets, or 4096 packets as
+ * ack_cnt accumulated over ACKs returning early, e.g., stretch ACKs.
+ */
+#define BICTCP_BENCH_ACKS	(1U << 20)
+#define BICTCP_BENCH_EPOCH	1024
+
+static u64 __init bictcp_bench_run(u32 cwnd, u32 acked, u32 *cnt)
+{
+	struct bictcp ca;
+	unsigned int j;
+	u64 t;
+
+	memset(&ca, 0, sizeof(ca));
+	ca.last_max_cwnd = cwnd + cwnd / 4;
+	t = ktime_get_ns();
+	for (j = 0; j < BICTCP_BENCH_ACKS; j++) {
+		/* tcp_jiffies32 hardly moves, and time goes back instead. */
+		ca.last_time = tcp_jiffies32 - HZ / 32 - 1;
+		if (j % BICTCP_BENCH_EPOCH == 0)
+			ca.epoch_start = 0;
+		else
+			ca.epoch_start = tcp_jiffies32 -
+			    j % BICTCP_BENCH_EPOCH ?: 1;
+		bictcp_update(&ca, cwnd, acked);
+	}
+	t = ktime_get_ns() - t;
+	*cnt = ca.cnt;
+	return div_u64(t, BICTCP_BENCH_ACKS);
+}
+
+static void __init bictcp_bench(void)
+{
+	static const u32 cwnds[] = { 10, 100, 1000, 10000, 100000, 1000000 };
+	static const u32 ackeds[] = { 64, 4096 };
+	unsigned int i, j;
+	u32 cnt_loop, cnt;
+	u64 t_loop, t;
+
+	for (j = 0; j < ARRAY_SIZE(ackeds); j++)
+		for (i = 0; i < ARRAY_SIZE(cwnds); i++) {
+			bictcp_bench_loop = true;
+			t_loop = bictcp_bench_run(cwnds[i], ackeds[j],
+						  &cnt_loop);
+			bictcp_bench_loop = false;
+			t = bictcp_bench_run(cwnds[i], ackeds[j], &cnt);
+			pr_info("leo-cubic: bench: cwnd %u acked %u: loop %llu ns/ack (cnt %u), closed form %llu ns/ack (cnt %u)\n",
+				cwnds[i], ackeds[j], t_loop, cnt_loop, t, cnt);
+			cond_resched();
+		}
+}
+#endif /* TCP_LEO_CUBIC_BENCH */
+
 static int __init cubictcp_register(void)
 {
 	int ret;
@@ -561,6 +1096,10 @@ static int __init cubictcp_register(void)
 	/* divide by bic_scale and by constant Srtt (100ms) */
 	do_div(cube_factor, bic_scale * 10);
 
+#ifdef TCP_LEO_CUBIC_BENCH
+	bictcp_bench();
+#endif /* TCP_LEO_CUBIC_BENCH */
+
 	ret = register_btf_kfunc_id_set(BPF_PROG_TYPE_STRUCT_OPS, &tcp_cubic_kfunc_set);
 	if (ret < 0)
 		return ret;
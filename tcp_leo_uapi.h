@@ -0,0 +1,152 @@
+/*
+ * definitions shared between TCP LEO and user space.
+ */
+#ifndef _TCP_LEO_UAPI_H_
+#define _TCP_LEO_UAPI_H_
+
+#include <linux/types.h>
+
+/*
+ * a per-ACK sample written to /sys/kernel/debug/tcp_leo/trace<cpu>.
+ * records are fixed-size, and never straddle relay sub-buffers.
+ */
+struct leo_trace_record {
+	__u64	time_us;	/* tcp_mstamp of the ACK */
+	__u64	cookie;		/* socket cookie, same as SO_COOKIE */
+	__u64	pacing_rate;	/* bytes per second */
+	__s32	rtt_us;		/* RTT sample, or -1 if none */
+	__u32	srtt_us;
+	__u32	delivered;	/* packets delivered so far */
+	__u32	inflight;	/* packets in flight */
+	__u32	cwnd;
+	__u32	ssthresh;
+	__u32	phase_us;	/* time in the handover interval */
+	__u8	ca_state;
+	__u8	suspended;	/* transmission suspended by LEO */
+	__u16	pad;
+};
+
+/*
+ * generic netlink interface to push a handover schedule, e.g.,
+ * from a daemon watching the dish status, and to listen edges
+ * of handover windows.
+ */
+#define LEO_GENL_NAME		"tcp_leo"
+#define LEO_GENL_VERSION	1
+#define LEO_GENL_MCGRP_EVENTS	"events"
+
+enum leo_genl_cmd {
+	LEO_CMD_UNSPEC,
+	LEO_CMD_GET_SCHEDULE,	/* reply the schedule */
+	LEO_CMD_SET_SCHEDULE,	/* replace given attributes of the schedule */
+	LEO_CMD_OUTAGE_START,	/* suspend all now until LEO_CMD_OUTAGE_END */
+	LEO_CMD_OUTAGE_END,
+	LEO_CMD_EVENT,		/* multicast notification */
+	LEO_CMD_SUBSCRIBE,	/* per-socket notification on or off */
+	LEO_CMD_ROUTE_ADD,	/* add or replace a route */
+	LEO_CMD_ROUTE_DEL,
+	LEO_CMD_ROUTE_FLUSH,
+	__LEO_CMD_MAX
+};
+#define LEO_CMD_MAX		(__LEO_CMD_MAX - 1)
+
+enum leo_genl_attr {
+	LEO_ATTR_UNSPEC,
+	LEO_ATTR_PAD,
+	LEO_ATTR_INTERVAL_MS,	/* u32: handover interval, divisor of a minute */
+	LEO_ATTR_TIME_MS,	/* u32: handover time in the interval */
+	LEO_ATTR_START_MS,	/* u32: window start before the handover */
+	LEO_ATTR_DURATION_MS,	/* u32: window duration */
+	LEO_ATTR_OFFSET_MS,	/* s32: phase offset */
+	LEO_ATTR_OUTAGE,	/* u8: in an outage notified */
+	LEO_ATTR_EVENT,		/* u8: enum leo_event */
+	LEO_ATTR_TIME_NS,	/* u64: CLOCK_REALTIME of the event */
+	LEO_ATTR_COOKIE,	/* u64: socket cookie, same as SO_COOKIE */
+	LEO_ATTR_NOTIFY,	/* u8: per-socket notification enabled */
+	LEO_ATTR_ADDR,		/* binary: IPv4 or IPv6 prefix of a route */
+	LEO_ATTR_PREFIXLEN,	/* u8: prefix length of a route */
+	LEO_ATTR_MODE,		/* u8: enum leo_route_mode */
+	__LEO_ATTR_MAX
+};
+#define LEO_ATTR_MAX		(__LEO_ATTR_MAX - 1)
+
+/*
+ * a route decides LEO of sockets to its peers at connection setup
+ * by longest prefix match.  LEO_ATTR_START_MS and
+ * LEO_ATTR_DURATION_MS replace those of the schedule while
+ * LEO_ATTR_OFFSET_MS is added to the schedule offset, e.g., for a
+ * different ground station.  sockets matching no route run LEO.
+ */
+enum leo_route_mode {
+	LEO_ROUTE_ENABLE,	/* run LEO */
+	LEO_ROUTE_DISABLE,	/* run the plain algorithm */
+	LEO_ROUTE_SHADOW,	/* only record */
+};
+
+enum leo_event {
+	LEO_EVENT_START,	/* handover window starts */
+	LEO_EVENT_END,		/* handover window ends */
+	LEO_EVENT_OUTAGE_START,
+	LEO_EVENT_OUTAGE_END,
+};
+
+/*
+ * per-socket notifications queued to the error queue of a socket
+ * subscribed by LEO_CMD_SUBSCRIBE, and read by recvmsg(2) with
+ * MSG_ERRQUEUE.  poll(2) reports POLLERR.  a notification is a
+ * struct sock_extended_err in IP_RECVERR or IPV6_RECVERR control
+ * message with:
+ *	ee_errno	0, sk_err is never set.
+ *	ee_origin	SO_EE_ORIGIN_LOCAL
+ *	ee_type		enum leo_notify
+ *	ee_code		LEO_NOTIFY_CODE
+ *	ee_info		ms until the window starts, 0 if started.
+ *	ee_data		ms of the window, 0 if unknown, e.g., outage.
+ */
+#define LEO_NOTIFY_CODE		0x4c	/* 'L' */
+
+enum leo_notify {
+	LEO_NOTIFY_SUSPEND = 1,	/* window is coming, or started */
+	LEO_NOTIFY_RESUME,	/* window ended, and transmission resumed */
+};
+
+/*
+ * a BPF program attached to leo_policy() in tcp_leo.c as fmod_ret
+ * can override handover decisions.  it receives struct
+ * leo_policy_ctx, and returns one of enum leo_policy_verdict.
+ */
+enum leo_policy_point {
+	LEO_POLICY_INIT,	/* a socket is initialized */
+	LEO_POLICY_ACK,		/* an ACK is received */
+	LEO_POLICY_TIMER,	/* an edge of the window by the timer */
+	LEO_POLICY_TX_START,	/* transmission starts after idle */
+};
+
+enum leo_policy_verdict {
+	LEO_POLICY_DEFAULT,	/* follow the schedule */
+	LEO_POLICY_SUSPEND,	/* suspend, or keep suspended */
+	LEO_POLICY_RESUME,	/* resume, or keep running */
+	LEO_POLICY_KEEP,	/* keep the current state */
+};
+
+/*
+ * a read-only page that user space can mmap(2) from /dev/tcp_leo
+ * to follow the handover schedule without system calls.  like
+ * vDSO, seq is odd while the kernel is updating the page, and
+ * readers must retry if seq is odd or changed while reading.
+ * times are CLOCK_REALTIME in ns.
+ */
+#define LEO_SHARED_VERSION	1
+
+struct leo_shared_page {
+	__u32	seq;
+	__u32	version;
+	__u64	time_base_ns;	/* start of the current handover interval */
+	__u64	interval_ns;
+	__u64	start_ns;	/* start of the current or next window */
+	__u64	end_ns;		/* end of the current or next window */
+	__u32	outage;		/* in an outage notified */
+	__u32	pad;
+};
+
+#endif /* ! _TCP_LEO_UAPI_H_ */
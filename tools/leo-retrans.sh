@@ -0,0 +1,121 @@
+#!/bin/sh
+#
+# leo-retrans.sh: compare retransmissions of bursty request/response
+# traffic with and without suspending sends starting in a window.
+#
+#	sudo tools/leo-retrans.sh [-n requests] [-s size] [-t think_ms]
+#
+# a leorr server in netns leo-srv answers a leorr client in leo-cli
+# over a veth pair with 20 ms of delay each way.  netem on the server
+# side drops everything in handover windows reported by "leoctl
+# monitor", i.e., outages are emulated on the schedule of the module.
+# retransmissions of the server are counted in turn for cubic,
+# leo-cubic with leo_tx_start=0, and leo-cubic with leo_tx_start=1,
+# and the script fails unless the last has fewer than the second.
+#
+# tcp_leo and tcp_leo_cubic must be loaded with leo_ifindex empty, and
+# the tools built by "make tools".
+#
+set -e
+
+TOOLS=$(cd "$(dirname "$0")" && pwd)
+LEOCTL=$TOOLS/leoctl
+LEORR=$TOOLS/leorr
+PARAM=/sys/module/tcp_leo/parameters
+SRV=leo-srv
+CLI=leo-cli
+PORT=5001
+DELAY=20ms
+
+N=200
+SIZE=262144
+THINK=2000
+while getopts n:s:t: ch; do
+	case $ch in
+	n)	N=$OPTARG;;
+	s)	SIZE=$OPTARG;;
+	t)	THINK=$OPTARG;;
+	*)	echo "usage: $0 [-n requests] [-s size] [-t think_ms]" >&2
+		exit 1;;
+	esac
+done
+
+[ -x "$LEOCTL" ] && [ -x "$LEORR" ] || { echo "make tools first" >&2; exit 1; }
+[ -d $PARAM ] || { echo "tcp_leo is not loaded" >&2; exit 1; }
+[ -z "$(cat $PARAM/leo_ifindex)" ] || { echo "leo_ifindex is set" >&2; exit 1; }
+
+TX_START=$(cat $PARAM/leo_tx_start)
+TMP=$(mktemp -d)
+
+cleanup() {
+	kill $(jobs -p) 2>/dev/null || true
+	echo "$TX_START" > $PARAM/leo_tx_start
+	rm -rf "$TMP"
+	ip netns del $SRV 2>/dev/null || true
+	ip netns del $CLI 2>/dev/null || true
+}
+trap cleanup EXIT INT TERM
+
+ip netns add $SRV
+ip netns add $CLI
+ip link add veth-srv netns $SRV type veth peer name veth-cli netns $CLI
+ip -n $SRV addr add 10.0.0.1/24 dev veth-srv
+ip -n $CLI addr add 10.0.0.2/24 dev veth-cli
+ip -n $SRV link set lo up
+ip -n $CLI link set lo up
+ip -n $SRV link set veth-srv up
+ip -n $CLI link set veth-cli up
+ip netns exec $SRV tc qdisc add dev veth-srv root netem delay $DELAY
+ip netns exec $CLI tc qdisc add dev veth-cli root netem delay $DELAY
+
+# drop everything from the server in windows.
+outage() {
+	ip netns exec $SRV tc qdisc change dev veth-srv root netem \
+	    delay $DELAY loss "$1"
+}
+mkfifo "$TMP/events"
+"$LEOCTL" monitor > "$TMP/events" &
+while read -r t event rest; do
+	case "$event $rest" in
+	"start "|"outage start")	outage 100%;;
+	"end "|"outage end")		outage 0%;;
+	esac
+done < "$TMP/events" &
+
+retrans() {
+	ip netns exec $SRV awk '/^Tcp:/ {
+		if (n++ == 0) {
+			for (i = 1; i <= NF; i++)
+				if ($i == "RetransSegs")
+					f = i
+		} else
+			print $f
+	}' /proc/net/snmp
+}
+
+run() {
+	ip netns exec $SRV "$LEORR" server -c "$1" -p $PORT &
+	pid=$!
+	sleep 1
+	before=$(retrans)
+	ip netns exec $CLI "$LEORR" client -p $PORT -n $N -s $SIZE -t $THINK \
+	    10.0.0.1
+	after=$(retrans)
+	kill $pid
+	wait $pid 2>/dev/null || true
+	nretrans=$((after - before))
+	echo "$2: retransmissions: $nretrans"
+}
+
+run cubic "cubic"
+echo 0 > $PARAM/leo_tx_start
+run leo-cubic "leo-cubic, leo_tx_start=0"
+without=$nretrans
+echo 1 > $PARAM/leo_tx_start
+run leo-cubic "leo-cubic, leo_tx_start=1"
+with=$nretrans
+
+if [ "$with" -ge "$without" ]; then
+	echo "leo_tx_start=1 does not reduce retransmissions" >&2
+	exit 1
+fi
@@ -0,0 +1,516 @@
+/*
+ * leoctl: control TCP LEO via generic netlink.
+ *
+ *	leoctl get
+ *	leoctl set [-i interval_ms] [-t time_ms] [-s start_ms]
+ *	    [-d duration_ms] [-o offset_ms]
+ *	leoctl outage start|end
+ *	leoctl subscribe cookie [on|off]
+ *	leoctl route add prefix[/len] [-m enable|disable|shadow]
+ *	    [-s start_ms] [-d duration_ms] [-o offset_ms]
+ *	leoctl route del prefix[/len]
+ *	leoctl route flush
+ *	leoctl monitor
+ *	leoctl mock [-p period_s]
+ *
+ * "mock" imitates a daemon watching the dish status for local
+ * testing.  it pushes a random phase offset every period, and
+ * sometimes reports an unscheduled outage.
+ */
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+
+#include <err.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../tcp_leo_uapi.h"
+
+#define NL_BUFSIZE	8192
+
+struct nl_msg {
+	struct nlmsghdr n;
+	struct genlmsghdr g;
+	char buf[256];
+};
+
+static int nl_fd;
+static uint16_t leo_family;
+static uint32_t leo_mcgrp;
+static uint32_t nl_seq;
+
+#define NLA_DATA(nla)	((void *)((char *)(nla) + NLA_HDRLEN))
+#define NLA_NEXT(nla)							\
+	((struct nlattr *)((char *)(nla) + NLA_ALIGN((nla)->nla_len)))
+#define NLA_OK(nla, len)						\
+	((len) >= (int)sizeof(struct nlattr) &&				\
+	 (nla)->nla_len >= sizeof(struct nlattr) &&			\
+	 (nla)->nla_len <= (len))
+
+static void
+nl_msg_init(struct nl_msg *m, uint16_t type, uint8_t cmd, uint16_t flags)
+{
+
+	memset(m, 0, sizeof(*m));
+	m->n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	m->n.nlmsg_type = type;
+	m->n.nlmsg_flags = NLM_F_REQUEST | flags;
+	m->n.nlmsg_seq = ++nl_seq;
+	m->g.cmd = cmd;
+	m->g.version = LEO_GENL_VERSION;
+}
+
+static void
+nl_msg_put(struct nl_msg *m, uint16_t type, const void *data, uint16_t len)
+{
+	struct nlattr *nla;
+
+	nla = (struct nlattr *)((char *)m + NLMSG_ALIGN(m->n.nlmsg_len));
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	memcpy(NLA_DATA(nla), data, len);
+	m->n.nlmsg_len = NLMSG_ALIGN(m->n.nlmsg_len) + NLA_ALIGN(nla->nla_len);
+}
+
+static void
+nl_send(struct nl_msg *m)
+{
+	struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+
+	if (sendto(nl_fd, m, m->n.nlmsg_len, 0, (struct sockaddr *)&sa,
+	    sizeof(sa)) < 0)
+		err(EXIT_FAILURE, "sendto");
+}
+
+/* receive one message, and return its genetlink attributes. */
+static struct nlattr *
+nl_recv(char *buf, int *lenp, uint8_t *cmdp)
+{
+	struct nlmsghdr *n;
+	struct nlmsgerr *e;
+	int len;
+
+	len = recv(nl_fd, buf, NL_BUFSIZE, 0);
+	if (len < 0)
+		err(EXIT_FAILURE, "recv");
+	n = (struct nlmsghdr *)buf;
+	if (! NLMSG_OK(n, len))
+		errx(EXIT_FAILURE, "truncated message");
+	if (n->nlmsg_type == NLMSG_ERROR) {
+		e = NLMSG_DATA(n);
+		if (e->error != 0) {
+			errno = -e->error;
+			err(EXIT_FAILURE, "request failed");
+		}
+		*lenp = 0;
+		return NULL;
+	}
+	if (cmdp != NULL)
+		*cmdp = ((struct genlmsghdr *)NLMSG_DATA(n))->cmd;
+	*lenp = n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	return (struct nlattr *)((char *)NLMSG_DATA(n) + GENL_HDRLEN);
+}
+
+static void
+nl_resolve(void)
+{
+	struct nlattr *nla, *grp, *ga;
+	struct nl_msg m;
+	char buf[NL_BUFSIZE];
+	int len, glen, galen;
+	char *name;
+
+	nl_msg_init(&m, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, 0);
+	m.g.version = 1;
+	nl_msg_put(&m, CTRL_ATTR_FAMILY_NAME, LEO_GENL_NAME,
+	    sizeof(LEO_GENL_NAME));
+	nl_send(&m);
+
+	for (nla = nl_recv(buf, &len, NULL); NLA_OK(nla, len);
+	    len -= NLA_ALIGN(nla->nla_len), nla = NLA_NEXT(nla)) {
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+		case CTRL_ATTR_FAMILY_ID:
+			leo_family = *(uint16_t *)NLA_DATA(nla);
+			break;
+		case CTRL_ATTR_MCAST_GROUPS:
+			glen = nla->nla_len - NLA_HDRLEN;
+			for (grp = NLA_DATA(nla); NLA_OK(grp, glen);
+			    glen -= NLA_ALIGN(grp->nla_len),
+			    grp = NLA_NEXT(grp)) {
+				name = NULL;
+				galen = grp->nla_len - NLA_HDRLEN;
+				for (ga = NLA_DATA(grp); NLA_OK(ga, galen);
+				    galen -= NLA_ALIGN(ga->nla_len),
+				    ga = NLA_NEXT(ga)) {
+					if (ga->nla_type ==
+					    CTRL_ATTR_MCAST_GRP_NAME)
+						name = NLA_DATA(ga);
+					else if (ga->nla_type ==
+					    CTRL_ATTR_MCAST_GRP_ID &&
+					    name != NULL &&
+					    strcmp(name,
+					    LEO_GENL_MCGRP_EVENTS) == 0)
+						leo_mcgrp =
+						    *(uint32_t *)NLA_DATA(ga);
+				}
+			}
+			break;
+		}
+	}
+	if (leo_family == 0)
+		errx(EXIT_FAILURE, "tcp_leo is not loaded");
+}
+
+static void
+leo_request(struct nl_msg *m)
+{
+	char buf[NL_BUFSIZE];
+	int len;
+
+	m->n.nlmsg_flags |= NLM_F_ACK;
+	nl_send(m);
+	(void)nl_recv(buf, &len, NULL);
+}
+
+static void
+leo_get(void)
+{
+	struct nlattr *nla;
+	struct nl_msg m;
+	char buf[NL_BUFSIZE];
+	int len;
+
+	nl_msg_init(&m, leo_family, LEO_CMD_GET_SCHEDULE, 0);
+	nl_send(&m);
+	for (nla = nl_recv(buf, &len, NULL); NLA_OK(nla, len);
+	    len -= NLA_ALIGN(nla->nla_len), nla = NLA_NEXT(nla)) {
+		switch (nla->nla_type) {
+		case LEO_ATTR_INTERVAL_MS:
+			printf("interval_ms: %u\n", *(uint32_t *)NLA_DATA(nla));
+			break;
+		case LEO_ATTR_TIME_MS:
+			printf("time_ms: %u\n", *(uint32_t *)NLA_DATA(nla));
+			break;
+		case LEO_ATTR_START_MS:
+			printf("start_ms: %u\n", *(uint32_t *)NLA_DATA(nla));
+			break;
+		case LEO_ATTR_DURATION_MS:
+			printf("duration_ms: %u\n", *(uint32_t *)NLA_DATA(nla));
+			break;
+		case LEO_ATTR_OFFSET_MS:
+			printf("offset_ms: %d\n", *(int32_t *)NLA_DATA(nla));
+			break;
+		case LEO_ATTR_OUTAGE:
+			printf("outage: %u\n", *(uint8_t *)NLA_DATA(nla));
+			break;
+		}
+	}
+}
+
+static void
+leo_set(int argc, char **argv)
+{
+	struct nl_msg m;
+	uint32_t v;
+	int32_t offset;
+	int ch;
+
+	nl_msg_init(&m, leo_family, LEO_CMD_SET_SCHEDULE, 0);
+	while ((ch = getopt(argc, argv, "i:t:s:d:o:")) != -1) {
+		switch (ch) {
+		case 'i':
+			v = strtoul(optarg, NULL, 0);
+			nl_msg_put(&m, LEO_ATTR_INTERVAL_MS, &v, sizeof(v));
+			break;
+		case 't':
+			v = strtoul(optarg, NULL, 0);
+			nl_msg_put(&m, LEO_ATTR_TIME_MS, &v, sizeof(v));
+			break;
+		case 's':
+			v = strtoul(optarg, NULL, 0);
+			nl_msg_put(&m, LEO_ATTR_START_MS, &v, sizeof(v));
+			break;
+		case 'd':
+			v = strtoul(optarg, NULL, 0);
+			nl_msg_put(&m, LEO_ATTR_DURATION_MS, &v, sizeof(v));
+			break;
+		case 'o':
+			offset = strtol(optarg, NULL, 0);
+			nl_msg_put(&m, LEO_ATTR_OFFSET_MS, &offset,
+			    sizeof(offset));
+			break;
+		default:
+			errx(EXIT_FAILURE, "unknown option");
+		}
+	}
+	leo_request(&m);
+}
+
+static void
+leo_outage(int start)
+{
+	struct nl_msg m;
+
+	nl_msg_init(&m, leo_family,
+	    start ? LEO_CMD_OUTAGE_START : LEO_CMD_OUTAGE_END, 0);
+	leo_request(&m);
+}
+
+static void
+leo_subscribe(const char *cookiestr, int on)
+{
+	struct nl_msg m;
+	uint64_t cookie;
+	uint8_t notify = on;
+	char *ep;
+
+	errno = 0;
+	cookie = strtoull(cookiestr, &ep, 0);
+	if (errno != 0 || *cookiestr == '\0' || *ep != '\0')
+		errx(EXIT_FAILURE, "invalid cookie: %s", cookiestr);
+	nl_msg_init(&m, leo_family, LEO_CMD_SUBSCRIBE, 0);
+	nl_msg_put(&m, LEO_ATTR_COOKIE, &cookie, sizeof(cookie));
+	nl_msg_put(&m, LEO_ATTR_NOTIFY, &notify, sizeof(notify));
+	leo_request(&m);
+}
+
+static void
+leo_route_prefix(struct nl_msg *m, char *prefix)
+{
+	unsigned char addr[sizeof(struct in6_addr)];
+	unsigned long plen;
+	uint16_t len;
+	uint8_t v;
+	char *p, *ep;
+
+	p = strchr(prefix, '/');
+	if (p != NULL)
+		*p++ = '\0';
+	if (inet_pton(AF_INET, prefix, addr) == 1)
+		len = sizeof(struct in_addr);
+	else if (inet_pton(AF_INET6, prefix, addr) == 1)
+		len = sizeof(struct in6_addr);
+	else
+		errx(EXIT_FAILURE, "invalid prefix: %s", prefix);
+	plen = len * 8;
+	if (p != NULL) {
+		plen = strtoul(p, &ep, 10);
+		if (*p == '\0' || *ep != '\0' || plen > len * 8)
+			errx(EXIT_FAILURE, "invalid prefix length: %s", p);
+	}
+	v = plen;
+	nl_msg_put(m, LEO_ATTR_ADDR, addr, len);
+	nl_msg_put(m, LEO_ATTR_PREFIXLEN, &v, sizeof(v));
+}
+
+static void
+leo_route(int argc, char **argv)
+{
+	static const char * const modes[] = {
+		[LEO_ROUTE_ENABLE]	= "enable",
+		[LEO_ROUTE_DISABLE]	= "disable",
+		[LEO_ROUTE_SHADOW]	= "shadow",
+	};
+	struct nl_msg m;
+	uint32_t v;
+	int32_t offset;
+	uint8_t mode;
+	int ch;
+
+	if (argc == 2 && strcmp(argv[1], "flush") == 0) {
+		nl_msg_init(&m, leo_family, LEO_CMD_ROUTE_FLUSH, 0);
+		leo_request(&m);
+		return;
+	}
+	if (argc == 3 && strcmp(argv[1], "del") == 0) {
+		nl_msg_init(&m, leo_family, LEO_CMD_ROUTE_DEL, 0);
+		leo_route_prefix(&m, argv[2]);
+		leo_request(&m);
+		return;
+	}
+	if (argc < 3 || strcmp(argv[1], "add") != 0)
+		errx(EXIT_FAILURE, "unknown route command");
+
+	nl_msg_init(&m, leo_family, LEO_CMD_ROUTE_ADD, 0);
+	leo_route_prefix(&m, argv[2]);
+	/* options follow the prefix. */
+	argc -= 2;
+	argv += 2;
+	while ((ch = getopt(argc, argv, "m:s:d:o:")) != -1) {
+		switch (ch) {
+		case 'm':
+			for (mode = 0; mode < sizeof(modes) / sizeof(modes[0]);
+			    mode++)
+				if (strcmp(optarg, modes[mode]) == 0)
+					break;
+			if (mode == sizeof(modes) / sizeof(modes[0]))
+				errx(EXIT_FAILURE, "unknown mode: %s", optarg);
+			nl_msg_put(&m, LEO_ATTR_MODE, &mode, sizeof(mode));
+			break;
+		case 's':
+			v = strtoul(optarg, NULL, 0);
+			nl_msg_put(&m, LEO_ATTR_START_MS, &v, sizeof(v));
+			break;
+		case 'd':
+			v = strtoul(optarg, NULL, 0);
+			nl_msg_put(&m, LEO_ATTR_DURATION_MS, &v, sizeof(v));
+			break;
+		case 'o':
+			offset = strtol(optarg, NULL, 0);
+			nl_msg_put(&m, LEO_ATTR_OFFSET_MS, &offset,
+			    sizeof(offset));
+			break;
+		default:
+			errx(EXIT_FAILURE, "unknown option");
+		}
+	}
+	leo_request(&m);
+}
+
+static void
+leo_monitor(void)
+{
+	static const char * const events[] = {
+		[LEO_EVENT_START]		= "start",
+		[LEO_EVENT_END]			= "end",
+		[LEO_EVENT_OUTAGE_START]	= "outage start",
+		[LEO_EVENT_OUTAGE_END]		= "outage end",
+	};
+	struct nlattr *nla;
+	char buf[NL_BUFSIZE];
+	uint64_t t;
+	uint8_t cmd, event;
+	int len;
+
+	if (leo_mcgrp == 0)
+		errx(EXIT_FAILURE, "no multicast group");
+	if (setsockopt(nl_fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+	    &leo_mcgrp, sizeof(leo_mcgrp)) < 0)
+		err(EXIT_FAILURE, "NETLINK_ADD_MEMBERSHIP");
+
+	for (;;) {
+		event = 0xff;
+		t = 0;
+		for (nla = nl_recv(buf, &len, &cmd); NLA_OK(nla, len);
+		    len -= NLA_ALIGN(nla->nla_len), nla = NLA_NEXT(nla)) {
+			if (nla->nla_type == LEO_ATTR_EVENT)
+				event = *(uint8_t *)NLA_DATA(nla);
+			else if (nla->nla_type == LEO_ATTR_TIME_NS)
+				memcpy(&t, NLA_DATA(nla), sizeof(t));
+		}
+		if (cmd != LEO_CMD_EVENT ||
+		    event >= sizeof(events) / sizeof(events[0]))
+			continue;
+		printf("%llu.%09llu %s\n",
+		    (unsigned long long)(t / 1000000000ULL),
+		    (unsigned long long)(t % 1000000000ULL), events[event]);
+		fflush(stdout);
+	}
+}
+
+static void
+leo_mock(int argc, char **argv)
+{
+	struct nl_msg m;
+	unsigned int period = 60;
+	int32_t offset;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "p:")) != -1) {
+		switch (ch) {
+		case 'p':
+			period = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			errx(EXIT_FAILURE, "unknown option");
+		}
+	}
+
+	srandom(time(NULL));
+	for (;;) {
+		/* the dish reports a slightly drifted reconfiguration. */
+		offset = (int32_t)(random() % 41) - 20;
+		nl_msg_init(&m, leo_family, LEO_CMD_SET_SCHEDULE, 0);
+		nl_msg_put(&m, LEO_ATTR_OFFSET_MS, &offset, sizeof(offset));
+		leo_request(&m);
+		printf("offset: %d ms\n", offset);
+
+		/* and an obstruction now and then. */
+		if (random() % 4 == 0) {
+			printf("outage\n");
+			leo_outage(1);
+			usleep(300 * 1000);
+			leo_outage(0);
+		}
+		fflush(stdout);
+		sleep(period);
+	}
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: leoctl get\n"
+	    "       leoctl set [-i interval_ms] [-t time_ms] [-s start_ms] "
+	    "[-d duration_ms] [-o offset_ms]\n"
+	    "       leoctl outage start|end\n"
+	    "       leoctl subscribe cookie [on|off]\n"
+	    "       leoctl route add prefix[/len] "
+	    "[-m enable|disable|shadow] [-s start_ms] [-d duration_ms] "
+	    "[-o offset_ms]\n"
+	    "       leoctl route del prefix[/len]\n"
+	    "       leoctl route flush\n"
+	    "       leoctl monitor\n"
+	    "       leoctl mock [-p period_s]\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+
+	if (argc < 2)
+		usage();
+
+	nl_fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+	if (nl_fd < 0)
+		err(EXIT_FAILURE, "socket");
+	if (bind(nl_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+		err(EXIT_FAILURE, "bind");
+	nl_resolve();
+
+	argc--;
+	argv++;
+	if (strcmp(argv[0], "get") == 0)
+		leo_get();
+	else if (strcmp(argv[0], "set") == 0)
+		leo_set(argc, argv);
+	else if (strcmp(argv[0], "outage") == 0 && argc == 2)
+		leo_outage(strcmp(argv[1], "start") == 0);
+	else if (strcmp(argv[0], "subscribe") == 0 &&
+	    (argc == 2 || argc == 3))
+		leo_subscribe(argv[1], argc == 2 || strcmp(argv[2], "off") != 0);
+	else if (strcmp(argv[0], "route") == 0)
+		leo_route(argc, argv);
+	else if (strcmp(argv[0], "monitor") == 0)
+		leo_monitor();
+	else if (strcmp(argv[0], "mock") == 0)
+		leo_mock(argc, argv);
+	else
+		usage();
+
+	close(nl_fd);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,207 @@
+/*
+ * leorr: bursty request/response traffic for leo-retrans.sh.
+ *
+ *	leorr server [-c congestion] [-p port]
+ *	leorr client [-p port] [-n requests] [-s size] [-t think_ms] host
+ *
+ * the client asks for size bytes over a single connection, reads
+ * them, and thinks for a random time up to think_ms so that
+ * responses start anywhere in and out of handover windows.  the
+ * server sends each response after idle, i.e., on CA_EVENT_TX_START.
+ */
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LEORR_PORT	5001
+#define LEORR_BUFSIZE	65536
+
+static char buf[LEORR_BUFSIZE];
+
+static void
+leorr_write(int fd, const void *p, size_t len)
+{
+	ssize_t n;
+
+	for (; len > 0; p = (const char *)p + n, len -= n)
+		if ((n = write(fd, p, len)) < 0)
+			err(EXIT_FAILURE, "write");
+}
+
+/* returns 0 on EOF before anything is read. */
+static int
+leorr_read(int fd, void *p, size_t len)
+{
+	size_t off;
+	ssize_t n;
+
+	for (off = 0; off < len; off += n) {
+		n = read(fd, (char *)p + off, len - off);
+		if (n < 0)
+			err(EXIT_FAILURE, "read");
+		if (n == 0) {
+			if (off == 0)
+				return 0;
+			errx(EXIT_FAILURE, "truncated");
+		}
+	}
+	return 1;
+}
+
+static void
+leorr_serve(int fd)
+{
+	uint32_t size;
+	size_t len;
+
+	while (leorr_read(fd, &size, sizeof(size))) {
+		for (size = ntohl(size); size > 0; size -= len) {
+			len = size < sizeof(buf) ? size : sizeof(buf);
+			leorr_write(fd, buf, len);
+		}
+	}
+}
+
+static void
+leorr_server(int argc, char **argv)
+{
+	struct sockaddr_in sin;
+	const char *cc = NULL;
+	int ch, fd, lfd, on = 1, port = LEORR_PORT;
+
+	while ((ch = getopt(argc, argv, "c:p:")) != -1) {
+		switch (ch) {
+		case 'c':
+			cc = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		default:
+			errx(EXIT_FAILURE, "unknown option");
+		}
+	}
+
+	if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		err(EXIT_FAILURE, "socket");
+	(void)setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	/* inherited by accepted sockets. */
+	if (cc != NULL && setsockopt(lfd, IPPROTO_TCP, TCP_CONGESTION,
+	    cc, strlen(cc)) < 0)
+		err(EXIT_FAILURE, "TCP_CONGESTION: %s", cc);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	if (bind(lfd, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+		err(EXIT_FAILURE, "bind");
+	if (listen(lfd, 1) < 0)
+		err(EXIT_FAILURE, "listen");
+
+	for (;;) {
+		if ((fd = accept(lfd, NULL, NULL)) < 0)
+			err(EXIT_FAILURE, "accept");
+		leorr_serve(fd);
+		close(fd);
+	}
+}
+
+static void
+leorr_client(int argc, char **argv)
+{
+	struct sockaddr_in sin;
+	struct timespec ts0, ts1;
+	unsigned int i, n = 100, size = 65536, think_ms = 1000;
+	uint32_t req;
+	size_t len, resid;
+	int ch, fd, port = LEORR_PORT;
+
+	while ((ch = getopt(argc, argv, "n:p:s:t:")) != -1) {
+		switch (ch) {
+		case 'n':
+			n = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			think_ms = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			errx(EXIT_FAILURE, "unknown option");
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		errx(EXIT_FAILURE, "no host");
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	if (inet_pton(AF_INET, argv[0], &sin.sin_addr) != 1)
+		errx(EXIT_FAILURE, "invalid host: %s", argv[0]);
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		err(EXIT_FAILURE, "socket");
+	if (connect(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+		err(EXIT_FAILURE, "connect");
+
+	srandom(time(NULL));
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i = 0; i < n; i++) {
+		if (think_ms != 0)
+			usleep((random() % think_ms) * 1000);
+		req = htonl(size);
+		leorr_write(fd, &req, sizeof(req));
+		for (resid = size; resid > 0; resid -= len) {
+			len = resid < sizeof(buf) ? resid : sizeof(buf);
+			if (! leorr_read(fd, buf, len))
+				errx(EXIT_FAILURE, "closed");
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	close(fd);
+
+	printf("requests: %u, size: %u, elapsed: %.3f s\n", n, size,
+	    (ts1.tv_sec - ts0.tv_sec) + (ts1.tv_nsec - ts0.tv_nsec) / 1e9);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: leorr server [-c congestion] [-p port]\n"
+	    "       leorr client [-p port] [-n requests] [-s size] "
+	    "[-t think_ms] host\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+
+	if (argc < 2)
+		usage();
+	argc--;
+	argv++;
+	if (strcmp(argv[0], "server") == 0)
+		leorr_server(argc, argv);
+	else if (strcmp(argv[0], "client") == 0)
+		leorr_client(argc, argv);
+	else
+		usage();
+	return 0;
+}
@@ -0,0 +1,296 @@
+/*
+ * libleo: header-only user-space counterpart of the handover
+ * scheduler in tcp_leo.c for transports other than TCP, e.g., QUIC.
+ *
+ * the semantics follow tcp_leo.c:
+ *	leo_sched_init()	leo_schedule_replace()
+ *	leo_sched_phase()	leo_phase()
+ *	leo_sched_handover()	is_leo_handover()
+ *	leo_sched_timeout()	leo_handover_timer_reset()
+ *	leo_pacer_check()	leo_handover_check() and leo_handover()
+ *
+ * the time in an interval is aligned to CLOCK_REALTIME modulo a
+ * minute as the kernel does.  a schedule can be given explicitly,
+ * or follow the one learned by the kernel, e.g., the offset pushed
+ * by a daemon, via the page mmap(2)ed from /dev/tcp_leo.  nothing
+ * here touches global state, and all functions take the current
+ * time so that they can be unit-tested with a fake clock.
+ */
+#ifndef _LIBLEO_H_
+#define _LIBLEO_H_
+
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../tcp_leo_uapi.h"
+
+#define LEO_NSEC_PER_MSEC		1000000ULL
+#define LEO_NSEC_PER_SEC		1000000000ULL
+#define LEO_NSEC_PER_MIN		(60 * LEO_NSEC_PER_SEC)
+#define LEO_MSEC_PER_MIN		60000U
+#define LEO_HANDOVER_OFFSET_MAX		1000U	/* ms */
+#define LEO_HANDOVER_TIME_JITTER	(10 * LEO_NSEC_PER_MSEC)
+
+/* times are in ns in the handover interval. */
+struct leo_sched {
+	uint64_t	interval;
+	uint64_t	time;		/* handover */
+	uint64_t	start;		/* window start */
+	uint64_t	end;		/* window end */
+	uint64_t	offset;		/* phase offset, 0<=offset<interval */
+	int		outage;		/* suspend all until cleared */
+};
+
+/* same defaults as the module parameters. */
+#define LEO_SCHED_DEFAULT_INTERVAL_MS	15000U
+#define LEO_SCHED_DEFAULT_TIME_MS	12000U
+#define LEO_SCHED_DEFAULT_START_MS	200U
+#define LEO_SCHED_DEFAULT_DURATION_MS	400U
+
+static inline uint64_t
+leo_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * LEO_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * validate and set a schedule given in ms.  returns 0 or -EINVAL
+ * with the same constraints as LEO_CMD_SET_SCHEDULE.
+ */
+static inline int
+leo_sched_init(struct leo_sched *s, uint32_t interval_ms, uint32_t time_ms,
+    uint32_t start_ms, uint32_t duration_ms, int32_t offset_ms)
+{
+	int64_t offset;
+
+	if (interval_ms == 0 || LEO_MSEC_PER_MIN % interval_ms != 0 ||
+	    start_ms > LEO_HANDOVER_OFFSET_MAX ||
+	    duration_ms > LEO_HANDOVER_OFFSET_MAX ||
+	    start_ms > time_ms ||
+	    time_ms - start_ms + duration_ms >= interval_ms)
+		return -EINVAL;
+
+	offset = offset_ms % (int64_t)interval_ms;
+	if (offset < 0)
+		offset += interval_ms;
+	s->interval = interval_ms * LEO_NSEC_PER_MSEC;
+	s->time = time_ms * LEO_NSEC_PER_MSEC;
+	s->start = s->time - start_ms * LEO_NSEC_PER_MSEC;
+	s->end = s->start + duration_ms * LEO_NSEC_PER_MSEC;
+	s->offset = offset * LEO_NSEC_PER_MSEC;
+	s->outage = 0;
+	return 0;
+}
+
+static inline void
+leo_sched_init_default(struct leo_sched *s)
+{
+
+	(void)leo_sched_init(s, LEO_SCHED_DEFAULT_INTERVAL_MS,
+	    LEO_SCHED_DEFAULT_TIME_MS, LEO_SCHED_DEFAULT_START_MS,
+	    LEO_SCHED_DEFAULT_DURATION_MS, 0);
+}
+
+static inline uint64_t
+leo_sched_phase(const struct leo_sched *s, uint64_t now)
+{
+
+	return (now % LEO_NSEC_PER_MIN + s->offset) % s->interval;
+}
+
+/* true if transmission should be suspended now. */
+static inline int
+leo_sched_handover(const struct leo_sched *s, uint64_t now)
+{
+	uint64_t phase;
+
+	if (s->outage)
+		return 1;
+	phase = leo_sched_phase(s, now);
+	return s->start <= phase && phase <= s->end;
+}
+
+/*
+ * ns until the next decision, i.e., the edge of the window.
+ * an outage is polled every interval as its end is notified
+ * asynchronously.
+ */
+static inline uint64_t
+leo_sched_timeout(const struct leo_sched *s, uint64_t now)
+{
+	uint64_t phase;
+
+	if (s->outage)
+		return s->interval;
+	phase = leo_sched_phase(s, now);
+	if (phase < s->start)
+		return s->start - phase;
+	else if (phase < s->end)
+		return s->end - phase;
+	else
+		return s->start + s->interval - phase;
+}
+
+/*
+ * snapshot the schedule learned by the kernel from a page mapped
+ * by leo_shared_map().  returns 0, or -EAGAIN if the page is not
+ * initialized yet.
+ */
+static inline int
+leo_sched_from_shared(struct leo_sched *s,
+    const volatile struct leo_shared_page *sp)
+{
+	uint64_t base, interval, start, end;
+	uint32_t seq, outage;
+
+	do {
+		seq = sp->seq;
+		__sync_synchronize();
+		base = sp->time_base_ns;
+		interval = sp->interval_ns;
+		start = sp->start_ns;
+		end = sp->end_ns;
+		outage = sp->outage;
+		__sync_synchronize();
+	} while ((seq & 1) || seq != sp->seq);
+	if (sp->version != LEO_SHARED_VERSION || interval == 0)
+		return -EAGAIN;
+
+	/* the interval divides a minute, and a phase is thus base-relative. */
+	s->interval = interval;
+	s->offset = (interval - base % interval) % interval;
+	s->start = (start - base) % interval;
+	s->end = s->start + (end - start);
+	s->time = s->start;	/* unknown, and unused for decisions */
+	s->outage = outage != 0;
+	return 0;
+}
+
+static inline const volatile struct leo_shared_page *
+leo_shared_map(void)
+{
+	void *p;
+	int fd;
+
+	fd = open("/dev/tcp_leo", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	p = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+	return p;
+}
+
+static inline void
+leo_shared_unmap(const volatile struct leo_shared_page *sp)
+{
+
+	munmap((void *)(uintptr_t)sp, sysconf(_SC_PAGESIZE));
+}
+
+/*
+ * pacer integration.  a transport calls leo_pacer_check() on every
+ * ACK and on the expiry of a timer armed with leo_pacer_timeout().
+ * on LEO_SUSPEND, the transport stops sending and uses *cwnd and
+ * *rate that are zeroed.  on LEO_RESUME, *cwnd and *rate are
+ * restored to the values saved at suspension, and the transport
+ * should flush pending data.  units of cwnd and rate are opaque,
+ * e.g., bytes and bytes per second.  like the shadow mode in the
+ * kernel, a pacer with shadow set only reports decisions.
+ */
+enum leo_action {
+	LEO_KEEP,
+	LEO_SUSPEND,
+	LEO_RESUME,
+};
+
+struct leo_pacer {
+	struct leo_sched	sched;
+	int			shadow;
+	int			suspended;
+	uint64_t		saved_cwnd;
+	uint64_t		saved_rate;
+	uint32_t		nsuspend;
+	uint32_t		nresume;
+};
+
+static inline void
+leo_pacer_init(struct leo_pacer *p, const struct leo_sched *s)
+{
+
+	p->sched = *s;
+	p->shadow = 0;
+	p->suspended = 0;
+	p->saved_cwnd = 0;
+	p->saved_rate = 0;
+	p->nsuspend = 0;
+	p->nresume = 0;
+}
+
+/* e.g., refreshed from the shared page on a schedule change. */
+static inline void
+leo_pacer_update(struct leo_pacer *p, const struct leo_sched *s)
+{
+
+	p->sched = *s;
+}
+
+static inline enum leo_action
+leo_pacer_check(struct leo_pacer *p, uint64_t now, uint64_t *cwnd,
+    uint64_t *rate)
+{
+
+	if (leo_sched_handover(&p->sched, now)) {
+		if (p->suspended)
+			return LEO_KEEP;
+		p->suspended = 1;
+		p->nsuspend++;
+		if (! p->shadow) {
+			p->saved_cwnd = *cwnd;
+			p->saved_rate = *rate;
+			*cwnd = 0;
+			*rate = 0;
+		}
+		return LEO_SUSPEND;
+	}
+	if (! p->suspended)
+		return LEO_KEEP;
+	p->suspended = 0;
+	p->nresume++;
+	if (! p->shadow) {
+		/* at least one packet as tcp_leo.c does. */
+		*cwnd = p->saved_cwnd != 0 ? p->saved_cwnd : 1;
+		*rate = p->saved_rate;
+	}
+	return LEO_RESUME;
+}
+
+static inline int
+leo_pacer_can_send(const struct leo_pacer *p)
+{
+
+	return p->shadow || ! p->suspended;
+}
+
+/*
+ * ns until leo_pacer_check() should be called without ACKs.  as
+ * timers may fire a bit early, pass now + LEO_HANDOVER_TIME_JITTER
+ * to leo_pacer_check() on expiry like leo_handover() in tcp_leo.c.
+ */
+static inline uint64_t
+leo_pacer_timeout(const struct leo_pacer *p, uint64_t now)
+{
+
+	return leo_sched_timeout(&p->sched, now);
+}
+
+#endif /* ! _LIBLEO_H_ */